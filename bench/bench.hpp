@@ -0,0 +1,68 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <kekmonitors/msg.hpp>
+#include <kekmonitors/stats.hpp>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Every benchmark prints one json object per result on stdout, with at least
+ * a "benchmark" key. run.cmake gathers them in a single file.
+ */
+namespace bench {
+
+typedef std::chrono::steady_clock Clock;
+
+// the original stdout. Anything else written there, like the logs of the
+// library, which may start before they can be turned off, goes to stderr
+inline FILE *const s_results = [] {
+    FILE *results = fdopen(dup(STDOUT_FILENO), "w");
+    if (!results || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+        std::cerr << "Couldn't keep stdout for the results" << std::endl;
+        std::exit(1);
+    }
+    return results;
+}();
+
+inline void report(const json &result) {
+    std::fputs((result.dump() + "\n").c_str(), s_results);
+    std::fflush(s_results);
+}
+
+inline double elapsedNs(const Clock::time_point &start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start)
+        .count();
+}
+
+using kekmonitors::latencyStats;
+
+// an array of items strings, similar to a whitelist
+inline json makePayload(size_t items) {
+    if (!items)
+        return nullptr;
+    json payload = json::array();
+    for (size_t i = 0; i < items; i++)
+        payload.push_back("whitelisted-keyword-" + std::to_string(i));
+    return payload;
+}
+
+[[noreturn]] inline void fail(const std::string &what) {
+    std::cerr << what << std::endl;
+    std::exit(1);
+}
+
+// points HOME to a new temporary directory, so that the config, sockets and
+// logs of the benchmark don't mix with the ones of a running moman. Must be
+// called before anything reads the config
+inline void useTemporaryHome() {
+    char dir[] = "/tmp/kekmonitors-bench-XXXXXX";
+    if (!mkdtemp(dir))
+        fail("Couldn't create a temporary HOME");
+    setenv("HOME", dir, 1);
+}
+} // namespace bench
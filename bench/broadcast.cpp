@@ -0,0 +1,108 @@
+/*
+ * Time to push the same Cmd to N framed connections over socketpairs, until
+ * every peer answered: "per_connection" lets every connection serialize its
+ * own copy of the Cmd, like config pushes used to, "shared" encodes it once
+ * in a SharedCmd whose bytes all the connections write.
+ */
+#include "bench.hpp"
+#include <boost/asio/io_context.hpp>
+#include <kekmonitors/connection.hpp>
+#include <sys/socket.h>
+
+using namespace kekmonitors;
+
+static void run(const char *mode, size_t targets, size_t items,
+                size_t broadcasts) {
+    io_context io;
+    std::vector<Connection::Ptr> clients, servers;
+    for (size_t i = 0; i < targets; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+            bench::fail("socketpair failed");
+        clients.push_back(Connection::create(io, Framing::LengthPrefixed));
+        servers.push_back(Connection::create(io, Framing::LengthPrefixed));
+        clients.back()->p_endpoint.assign(local::stream_protocol{}, fds[0]);
+        servers.back()->p_endpoint.assign(local::stream_protocol{}, fds[1]);
+    }
+
+    // answers every cmd, until the client closes
+    std::function<void(Connection::Ptr)> serve = [&](Connection::Ptr server) {
+        server->asyncReadCmd(
+            [&, server](const error_code &err, const Cmd &cmd,
+                        Connection::Ptr) {
+                if (err)
+                    return;
+                server->asyncWriteResponse(
+                    Response::okResponse(), cmd.requestId(),
+                    [](const error_code &, Connection::Ptr) {});
+                serve(server);
+            },
+            Connection::s_idleTimeout);
+    };
+    for (auto &server : servers)
+        serve(server);
+
+    Cmd cmd;
+    cmd.setCmd(COMMANDS::SET_COMMON_WHITELIST);
+    cmd.setPayload(bench::makePayload(items));
+    const bool shared = std::string{mode} == "shared";
+    std::vector<double> latencies;
+    size_t done = 0, answered = 0;
+    bench::Clock::time_point sentAt;
+    std::function<void()> next = [&] {
+        if (done == broadcasts) {
+            for (auto &client : clients)
+                client->close();
+            for (auto &server : servers)
+                server->close();
+            return;
+        }
+        sentAt = bench::Clock::now();
+        answered = 0;
+        // a new SharedCmd per broadcast: its encoding is part of the cost
+        const auto sharedCmd = shared ? SharedCmd::create(cmd) : nullptr;
+        const auto onResponse = [&](const error_code &err, const Response &,
+                                    Connection::Ptr) {
+            if (err)
+                bench::fail("bad response: " + err.message());
+            if (++answered < targets)
+                return;
+            latencies.push_back(bench::elapsedNs(sentAt));
+            done++;
+            next();
+        };
+        const auto onWritten = [&, onResponse](const error_code &err,
+                                               Connection::Ptr client) {
+            if (err)
+                bench::fail("write failed: " + err.message());
+            client->asyncReadResponse(onResponse);
+        };
+        for (auto &client : clients) {
+            if (shared)
+                client->asyncWriteCmd(sharedCmd, 1, onWritten);
+            else
+                client->asyncWriteCmd(cmd, onWritten);
+        }
+    };
+    next();
+    io.run();
+
+    json result{{"benchmark", "broadcast"},
+                {"mode", mode},
+                {"targets", targets},
+                {"payload_items", items},
+                {"message_bytes", cmd.toString().size()},
+                {"broadcasts", broadcasts}};
+    result.update(bench::latencyStats(std::move(latencies)));
+    bench::report(result);
+}
+
+int main() {
+    kekmonitors::initMaps();
+    spdlog::set_level(spdlog::level::off);
+    for (const size_t targets : {10, 100, 400})
+        for (const size_t items : {10, 10000})
+            for (const char *mode : {"per_connection", "shared"})
+                run(mode, targets, items, items >= 1000 ? 20 : 200);
+    return 0;
+}
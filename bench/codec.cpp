@@ -0,0 +1,108 @@
+/*
+ * Cmd and Response encode (toString) and decode (fromString) throughput, for
+ * every wire encoding and a few payload sizes. encode_reuse serializes into
+ * the same string every time, like Connection does with its spare buffers,
+ * encode_dom dumps toJson() like toString used to.
+ */
+#include "bench.hpp"
+
+using namespace kekmonitors;
+
+static const char *encodingName(Encoding encoding) {
+    switch (encoding) {
+    case Encoding::MessagePack:
+        return "msgpack";
+    case Encoding::Cbor:
+        return "cbor";
+    default:
+        return "json";
+    }
+}
+
+static std::string dumpDom(const json &obj, Encoding encoding) {
+    std::string str;
+    switch (encoding) {
+    case Encoding::MessagePack:
+        json::to_msgpack(obj, str);
+        break;
+    case Encoding::Cbor:
+        json::to_cbor(obj, str);
+        break;
+    default:
+        str = obj.dump();
+    }
+    return str;
+}
+
+template <typename Message>
+static void run(const char *message, Encoding encoding, size_t items,
+                const Message &original) {
+    const auto encoded = original.toString(encoding);
+    const size_t iterations = std::max<size_t>(20, 20000000 / encoded.size());
+    error_code ec;
+
+    auto start = bench::Clock::now();
+    size_t bytes = 0;
+    for (size_t i = 0; i < iterations; i++)
+        bytes += original.toString(encoding).size();
+    const double encodeNs = bench::elapsedNs(start);
+
+    start = bench::Clock::now();
+    std::string reused;
+    for (size_t i = 0; i < iterations; i++) {
+        reused.clear();
+        original.serialize(reused, encoding);
+        bytes += reused.size();
+    }
+    const double encodeReuseNs = bench::elapsedNs(start);
+
+    start = bench::Clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        bytes += dumpDom(original.toJson(), encoding).size();
+    const double encodeDomNs = bench::elapsedNs(start);
+
+    start = bench::Clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        const auto decoded = Message::fromString(encoded.data(),
+                                                 encoded.size(), encoding, ec);
+        if (ec)
+            bench::fail("decode failed: " + ec.message());
+    }
+    const double decodeNs = bench::elapsedNs(start);
+
+    for (const auto &op : {std::make_pair("encode", encodeNs),
+                           std::make_pair("encode_reuse", encodeReuseNs),
+                           std::make_pair("encode_dom", encodeDomNs),
+                           std::make_pair("decode", decodeNs)})
+        bench::report(
+            {{"benchmark", "codec"},
+             {"message", message},
+             {"op", op.first},
+             {"encoding", encodingName(encoding)},
+             {"payload_items", items},
+             {"message_bytes", encoded.size()},
+             {"iterations", iterations},
+             {"ns_per_message", op.second / iterations},
+             {"mb_per_s", encoded.size() * iterations / (op.second / 1e9) /
+                              (1024 * 1024)}});
+    if (bytes != encoded.size() * iterations * 3)
+        bench::fail("encode is not deterministic");
+}
+
+int main() {
+    kekmonitors::initMaps();
+    for (const auto encoding :
+         {Encoding::Json, Encoding::MessagePack, Encoding::Cbor})
+        for (const size_t items : {0, 10, 1000, 10000}) {
+            Cmd cmd;
+            cmd.setCmd(COMMANDS::SET_COMMON_WHITELIST);
+            cmd.setPayload(bench::makePayload(items));
+            run("cmd", encoding, items, cmd);
+
+            Response response = Response::okResponse();
+            response.setInfo("Done.");
+            response.setPayload(bench::makePayload(items));
+            run("response", encoding, items, response);
+        }
+    return 0;
+}
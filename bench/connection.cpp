@@ -0,0 +1,178 @@
+/*
+ * Round trip latency of a Cmd and its Response between two framed
+ * Connections over a socketpair: no server nor handler in the way, only the
+ * codec, the framing and the strands.
+ * The burst runs queue many Cmds at once, which the write queue gathers in as
+ * few writes as possible, and time until every Response came back.
+ */
+#include "bench.hpp"
+#include <boost/asio/io_context.hpp>
+#include <kekmonitors/connection.hpp>
+#include <sys/socket.h>
+
+using namespace kekmonitors;
+
+static void run(size_t items, size_t roundTrips) {
+    io_context io;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+        bench::fail("socketpair failed");
+    auto client = Connection::create(io, Framing::LengthPrefixed);
+    auto server = Connection::create(io, Framing::LengthPrefixed);
+    client->p_endpoint.assign(local::stream_protocol{}, fds[0]);
+    server->p_endpoint.assign(local::stream_protocol{}, fds[1]);
+
+    // echoes the payload back, until the client closes
+    std::function<void()> serve = [&] {
+        server->asyncReadCmd(
+            [&](const error_code &err, const Cmd &cmd, Connection::Ptr) {
+                if (err)
+                    return;
+                Response response = Response::okResponse();
+                response.setPayload(cmd.payload());
+                server->asyncWriteResponse(
+                    response, cmd.requestId(),
+                    [](const error_code &, Connection::Ptr) {});
+                serve();
+            },
+            Connection::s_idleTimeout);
+    };
+    serve();
+
+    Cmd cmd;
+    cmd.setCmd(COMMANDS::SET_COMMON_WHITELIST);
+    cmd.setPayload(bench::makePayload(items));
+    const size_t warmup = roundTrips / 10;
+    std::vector<double> latencies;
+    latencies.reserve(roundTrips);
+    size_t done = 0;
+    bench::Clock::time_point sentAt, start;
+    std::function<void()> next = [&] {
+        if (done == warmup)
+            start = bench::Clock::now();
+        if (done == warmup + roundTrips) {
+            client->close();
+            server->close();
+            return;
+        }
+        sentAt = bench::Clock::now();
+        cmd.setRequestId(static_cast<uint32_t>(done));
+        client->asyncWriteCmd(cmd, [&](const error_code &err,
+                                       Connection::Ptr) {
+            if (err)
+                bench::fail("write failed: " + err.message());
+            client->asyncReadResponse([&](const error_code &err,
+                                          const Response &response,
+                                          Connection::Ptr) {
+                if (err || response.requestId() != done)
+                    bench::fail("bad response: " + err.message());
+                if (done++ >= warmup)
+                    latencies.push_back(bench::elapsedNs(sentAt));
+                next();
+            });
+        });
+    };
+    next();
+    io.run();
+
+    json result{{"benchmark", "connection_round_trip"},
+                {"framing", "length_prefixed"},
+                {"payload_items", items},
+                {"message_bytes", cmd.toString().size()},
+                {"round_trips", roundTrips},
+                {"round_trips_per_s",
+                 roundTrips / (bench::elapsedNs(start) / 1e9)}};
+    result.update(bench::latencyStats(std::move(latencies)));
+    bench::report(result);
+}
+
+static void runBurst(size_t items, size_t burst, size_t bursts) {
+    io_context io;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+        bench::fail("socketpair failed");
+    auto client = Connection::create(io, Framing::LengthPrefixed);
+    auto server = Connection::create(io, Framing::LengthPrefixed);
+    client->p_endpoint.assign(local::stream_protocol{}, fds[0]);
+    server->p_endpoint.assign(local::stream_protocol{}, fds[1]);
+
+    // answers every cmd, until the client closes
+    std::function<void()> serve = [&] {
+        server->asyncReadCmd(
+            [&](const error_code &err, const Cmd &cmd, Connection::Ptr) {
+                if (err)
+                    return;
+                server->asyncWriteResponse(
+                    Response::okResponse(), cmd.requestId(),
+                    [](const error_code &, Connection::Ptr) {});
+                serve();
+            },
+            Connection::s_idleTimeout);
+    };
+    serve();
+
+    Cmd cmd;
+    cmd.setCmd(COMMANDS::SET_COMMON_WHITELIST);
+    cmd.setPayload(bench::makePayload(items));
+    std::vector<double> latencies;
+    latencies.reserve(bursts);
+    size_t done = 0, answered = 0;
+    bench::Clock::time_point sentAt, start = bench::Clock::now();
+    std::function<void()> readResponse;
+    std::function<void()> next = [&] {
+        if (done == bursts) {
+            client->close();
+            server->close();
+            return;
+        }
+        sentAt = bench::Clock::now();
+        answered = 0;
+        for (size_t i = 0; i < burst; i++) {
+            cmd.setRequestId(static_cast<uint32_t>(i + 1));
+            client->asyncWriteCmd(cmd, [](const error_code &err,
+                                          Connection::Ptr) {
+                if (err)
+                    bench::fail("write failed: " + err.message());
+            });
+        }
+        readResponse();
+    };
+    readResponse = [&] {
+        client->asyncReadResponse([&](const error_code &err,
+                                      const Response &response,
+                                      Connection::Ptr) {
+            if (err || response.requestId() != ++answered)
+                bench::fail("bad response: " + err.message());
+            if (answered < burst) {
+                readResponse();
+                return;
+            }
+            latencies.push_back(bench::elapsedNs(sentAt));
+            done++;
+            next();
+        });
+    };
+    next();
+    io.run();
+
+    json result{{"benchmark", "connection_burst"},
+                {"framing", "length_prefixed"},
+                {"payload_items", items},
+                {"message_bytes", cmd.toString().size()},
+                {"burst", burst},
+                {"bursts", bursts},
+                {"messages_per_s",
+                 burst * bursts / (bench::elapsedNs(start) / 1e9)}};
+    result.update(bench::latencyStats(std::move(latencies)));
+    bench::report(result);
+}
+
+int main() {
+    kekmonitors::initMaps();
+    spdlog::set_level(spdlog::level::off);
+    for (const size_t items : {0, 10, 1000, 10000})
+        run(items, items >= 1000 ? 2000 : 20000);
+    for (const size_t burst : {8, 64, 256})
+        runBurst(10, burst, 1000);
+    return 0;
+}
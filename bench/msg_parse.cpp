@@ -0,0 +1,126 @@
+/*
+ * Compares the old Cmd parse path used by Connection (copy the read buffer
+ * into a std::string, parse it, copy the payload out of the json) with the
+ * current one (parse straight from the read buffer, move the payload).
+ * "dom" always parses the whole message with nlohmann, like the current path
+ * does unless built with KEKMONITORS_SIMDJSON, in which case the current path
+ * only parses the payload when payload() is called ("zero_copy_payload").
+ * What the paths copy is reported as bytes_allocated_per_message, the bytes
+ * requested from operator new: every copy of the message or of its payload
+ * goes to a new allocation, memcpy'd bytes aren't counted on their own.
+ */
+#include "bench.hpp"
+#include <atomic>
+#include <new>
+
+static std::atomic<size_t> s_allocatedBytes{0};
+
+void *operator new(size_t size) {
+    s_allocatedBytes += size;
+    if (void *ptr = std::malloc(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+using namespace kekmonitors;
+
+#ifdef KEKMONITORS_HAVE_SIMDJSON
+static const bool s_simdjson = true;
+#else
+static const bool s_simdjson = false;
+#endif
+
+// roughly what a monitor sends for every shoe it finds, ~350 bytes each
+static json makeShoes(size_t items) {
+    json payload = json::array();
+    for (size_t i = 0; i < items; i++) {
+        const auto id = std::to_string(i);
+        payload.push_back(
+            {{"name", "Some Shoe " + id + " \"Black/White\""},
+             {"link", "https://www.example.com/product/some-shoe-" + id},
+             {"img_link", "https://cdn.example.com/img/" + id + ".jpg"},
+             {"price", "120.00 EUR"},
+             {"sizes",
+              {{"40", {{"available", true}, {"atc", "?pid=" + id + "40"}}},
+               {"41", {{"available", false}, {"atc", "?pid=" + id + "41"}}},
+               {"42", {{"available", true}, {"atc", "?pid=" + id + "42"}}}}},
+             {"reason", 1},
+             {"first_seen", 1600000000 + i}});
+    }
+    return payload;
+}
+
+static std::vector<char> makeMessage(json &&payload) {
+    Cmd cmd;
+    cmd.setCmd(COMMANDS::SET_COMMON_WHITELIST);
+    if (!payload.empty())
+        cmd.setPayload(std::move(payload));
+    const auto str = cmd.toString();
+    return {str.begin(), str.end()};
+}
+
+template <typename F>
+static void run(const char *path, const char *payloadType,
+                const std::vector<char> &message, size_t items, F &&parse) {
+    const size_t iterations = std::max<size_t>(10, 2000000 / message.size());
+    error_code ec;
+    // warm up
+    parse(message, ec);
+    const size_t allocatedBefore = s_allocatedBytes;
+    const auto start = bench::Clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        const Cmd cmd = parse(message, ec);
+        if (ec || cmd.cmd() != COMMANDS::SET_COMMON_WHITELIST)
+            bench::fail("parse failed");
+    }
+    const double elapsedNs = bench::elapsedNs(start);
+    bench::report({
+        {"benchmark", "msg_parse"},
+        {"path", path},
+        {"simdjson", s_simdjson},
+        {"payload", payloadType},
+        {"payload_items", items},
+        {"message_bytes", message.size()},
+        {"iterations", iterations},
+        {"ns_per_message", elapsedNs / iterations},
+        {"bytes_allocated_per_message",
+         (s_allocatedBytes - allocatedBefore) / iterations}});
+}
+
+template <typename F>
+static void runAll(const char *payloadType, size_t items, F &&makePayload) {
+    const auto message = makeMessage(makePayload(items));
+    run("copy", payloadType, message, items,
+        [](const std::vector<char> &buf, error_code &ec) {
+            const std::string str{buf.begin(), buf.end()};
+            const json obj = json::parse(str);
+            return Cmd::fromJson(obj, ec);
+        });
+    run("dom", payloadType, message, items,
+        [](const std::vector<char> &buf, error_code &ec) {
+            return Cmd::fromJson(json::parse(buf.begin(), buf.end()), ec);
+        });
+    run("zero_copy", payloadType, message, items,
+        [](const std::vector<char> &buf, error_code &ec) {
+            return Cmd::fromString(boost::asio::buffer(buf), ec);
+        });
+    run("zero_copy_payload", payloadType, message, items,
+        [](const std::vector<char> &buf, error_code &ec) {
+            auto cmd = Cmd::fromString(boost::asio::buffer(buf), ec);
+            if (cmd.payload().is_discarded())
+                ec = boost::system::errc::make_error_code(
+                    boost::system::errc::invalid_argument);
+            return cmd;
+        });
+}
+
+int main() {
+    for (const size_t items : {0, 10, 1000, 10000})
+        runAll("whitelist", items, bench::makePayload);
+    // the last one is ~3.5MB
+    for (const size_t items : {100, 1000, 10000})
+        runAll("shoes", items, makeShoes);
+    return 0;
+}
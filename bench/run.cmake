@@ -0,0 +1,42 @@
+# Runs the benchmarks BENCHMARKS ("|" separated names) found in BENCH_DIR and
+# writes all their results to OUTPUT:
+#   {"date": ..., "build_type": ..., "results": [one object per result]}
+
+string(REPLACE "|" ";" BENCHMARKS "${BENCHMARKS}")
+set(RESULTS "")
+foreach(BENCHMARK ${BENCHMARKS})
+	message(STATUS "Running ${BENCHMARK}")
+	execute_process(COMMAND ${BENCH_DIR}/${BENCHMARK}
+		OUTPUT_VARIABLE BENCHMARK_OUTPUT
+		RESULT_VARIABLE BENCHMARK_RESULT)
+	if (NOT BENCHMARK_RESULT EQUAL 0)
+		message(FATAL_ERROR "${BENCHMARK} failed: ${BENCHMARK_RESULT}")
+	endif()
+	# one result per line: anything that isn't a json object is skipped, so
+	# that a stray message can't make the whole file invalid
+	# ; and unbalanced [] would break the list of lines
+	string(REPLACE ";" "<SEMICOLON>" BENCHMARK_OUTPUT "${BENCHMARK_OUTPUT}")
+	string(REPLACE "[" "<OPEN>" BENCHMARK_OUTPUT "${BENCHMARK_OUTPUT}")
+	string(REPLACE "]" "<CLOSE>" BENCHMARK_OUTPUT "${BENCHMARK_OUTPUT}")
+	string(REPLACE "\n" ";" BENCHMARK_LINES "${BENCHMARK_OUTPUT}")
+	foreach(LINE ${BENCHMARK_LINES})
+		string(REPLACE "<SEMICOLON>" ";" LINE "${LINE}")
+		string(REPLACE "<OPEN>" "[" LINE "${LINE}")
+		string(REPLACE "<CLOSE>" "]" LINE "${LINE}")
+		string(STRIP "${LINE}" LINE)
+		if (NOT LINE MATCHES "^{.*}$")
+			if (LINE)
+				message(WARNING "${BENCHMARK}: skipping \"${LINE}\"")
+			endif()
+			continue()
+		endif()
+		if (RESULTS)
+			string(APPEND RESULTS ",\n")
+		endif()
+		string(APPEND RESULTS "${LINE}")
+	endforeach()
+endforeach()
+
+string(TIMESTAMP DATE UTC)
+file(WRITE ${OUTPUT} "{\"date\": \"${DATE}\", \"build_type\": \"${BUILD_TYPE}\", \"results\": [\n${RESULTS}\n]}\n")
+message(STATUS "Results written to ${OUTPUT}")
@@ -0,0 +1,54 @@
+/*
+ * Cost of MM_GET_MONITOR_STATUS with many stored monitors: building the
+ * payload with MonitorManager::statusPayload and serializing the response.
+ */
+#include "bench.hpp"
+#include "moman.hpp"
+#include <boost/asio/io_context.hpp>
+
+using namespace kekmonitors;
+
+static void run(size_t objects, size_t iterations) {
+    io_context io;
+    Strand strand(io.get_executor());
+    std::unordered_map<std::string, StoredObject> storedObjects;
+    storedObjects.reserve(objects);
+    for (size_t i = 0; i < objects; i++) {
+        const auto className = "Monitor" + std::to_string(i);
+        StoredObject object(className);
+        // only toJson() is called: no process to start nor to watch
+        object.p_process = std::make_unique<Process>(
+            io, strand, className, [](int, const std::error_code &) {});
+        object.p_endpoint = std::make_unique<local::stream_protocol::endpoint>(
+            "/tmp/kekmonitors-bench/sockets/" + className);
+        storedObjects.emplace(className, std::move(object));
+    }
+
+    size_t bytes = 0;
+    double payloadNs = 0, serializeNs = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        auto start = bench::Clock::now();
+        Response response;
+        response.setPayload(MonitorManager::statusPayload(storedObjects));
+        payloadNs += bench::elapsedNs(start);
+        start = bench::Clock::now();
+        bytes = response.toString().size();
+        serializeNs += bench::elapsedNs(start);
+    }
+    bench::report(
+        {{"benchmark", "get_status"},
+         {"stored_objects", objects},
+         {"iterations", iterations},
+         {"response_bytes", bytes},
+         {"payload_us", payloadNs / iterations / 1000},
+         {"serialize_us", serializeNs / iterations / 1000},
+         {"total_us", (payloadNs + serializeNs) / iterations / 1000}});
+}
+
+int main() {
+    kekmonitors::initMaps();
+    spdlog::set_level(spdlog::level::off);
+    for (const size_t objects : {100, 1000, 10000})
+        run(objects, objects >= 10000 ? 20 : 200);
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Requests per second a UnixServer answers with many concurrent clients, each
+ * sending PINGs one after the other. Framed clients keep their connection,
+ * eof ones (like the python monitors) open a new one for every request.
+ */
+#include "bench.hpp"
+#include "server.hpp"
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <kekmonitors/connection.hpp>
+#include <thread>
+
+using namespace kekmonitors;
+
+struct PingHandler {
+    void onPing(const Cmd &cmd, const UserResponseCallback &&cb,
+                Connection::Ptr connection) {
+        cb(Response::okResponse(), connection);
+    }
+};
+
+static constexpr CmdHandlerEntry s_handlers[] = {
+    {COMMANDS::PING,
+     CmdDispatcher<PingHandler>::handler<&PingHandler::onPing>}};
+
+static void run(Framing framing, size_t clients, size_t requestsPerClient,
+                unsigned int threads) {
+    io_context io;
+    PingHandler handler;
+    Metrics metrics;
+    UnixServer server(io, "UnixServerBench", Strand(io.get_executor()),
+                      &handler, makeCmdHandlerTable(s_handlers));
+    // its logger is created by the constructor: what it logged so far went
+    // to stderr, see bench::s_results
+    spdlog::set_level(spdlog::level::off);
+    server.setMetrics(&metrics);
+    server.startAccepting();
+    const local::stream_protocol::endpoint endpoint(server.serverPath());
+
+    Cmd ping;
+    ping.setCmd(COMMANDS::PING);
+    std::vector<std::vector<double>> latencies(clients);
+    std::atomic<size_t> running{clients};
+    std::vector<Connection::Ptr> connections(clients);
+    std::vector<std::function<void(size_t)>> loops(clients);
+    for (size_t client = 0; client < clients; client++) {
+        latencies[client].reserve(requestsPerClient);
+        loops[client] = [&, client](size_t done) {
+            if (done == requestsPerClient) {
+                if (connections[client])
+                    connections[client]->close();
+                if (!--running)
+                    server.shutdown();
+                return;
+            }
+            const auto sentAt = bench::Clock::now();
+            auto &connection = connections[client];
+            if (!connection || framing == Framing::Eof) {
+                connection = Connection::create(io, framing);
+                error_code ec;
+                connection->p_endpoint.connect(endpoint, ec);
+                if (ec)
+                    bench::fail("connect failed: " + ec.message());
+            }
+            connection->asyncWriteCmd(
+                ping, [&, client, done, sentAt](const error_code &err,
+                                                Connection::Ptr connection) {
+                    if (err)
+                        bench::fail("write failed: " + err.message());
+                    connection->asyncReadResponse(
+                        [&, client, done, sentAt](const error_code &err,
+                                                  const Response &response,
+                                                  Connection::Ptr) {
+                            if (err || response.error())
+                                bench::fail("bad response: " + err.message());
+                            latencies[client].push_back(
+                                bench::elapsedNs(sentAt));
+                            loops[client](done + 1);
+                        });
+                });
+        };
+    }
+
+    const auto start = bench::Clock::now();
+    for (size_t client = 0; client < clients; client++)
+        post(io, [&, client] { loops[client](0); });
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threads; i++)
+        pool.emplace_back([&io] { io.run(); });
+    io.run();
+    for (auto &thread : pool)
+        thread.join();
+    const double elapsedNs = bench::elapsedNs(start);
+
+    std::vector<double> all;
+    for (const auto &clientLatencies : latencies)
+        all.insert(all.end(), clientLatencies.begin(), clientLatencies.end());
+    json result{
+        {"benchmark", "unix_server"},
+        {"framing", framing == Framing::Eof ? "eof" : "length_prefixed"},
+        {"clients", clients},
+        {"threads", threads},
+        {"requests", all.size()},
+        {"requests_per_s", all.size() / (elapsedNs / 1e9)}};
+    result.update(bench::latencyStats(std::move(all)));
+    bench::report(result);
+}
+
+int main() {
+    bench::useTemporaryHome();
+    // no init(): neither the database nor the debug logger are needed
+    kekmonitors::initMaps();
+    std::vector<unsigned int> threadCounts{1};
+    if (std::thread::hardware_concurrency() > 1)
+        threadCounts.push_back(std::thread::hardware_concurrency());
+    for (const unsigned int threads : threadCounts)
+        for (const size_t clients : {1, 16, 256}) {
+            run(Framing::LengthPrefixed, clients, 20000 / clients + 100,
+                threads);
+            run(Framing::Eof, clients, 5000 / clients + 20, threads);
+        }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <kekmonitors/connection.hpp>
+#include <kekmonitors/core.hpp>
+#include <kekmonitors/msg.hpp>
+#include <unordered_map>
+
+using namespace boost::asio;
+
+namespace kekmonitors {
+
+/*
+ * Client side of a monitor/scraper socket.
+ * With Framing::LengthPrefixed a single connection is kept open and every
+ * Cmd gets its own request id, so that many of them can be in flight at the
+ * same time, encoded as m_encoding. With Framing::Eof (python monitors)
+ * every Cmd still uses its own connection and json.
+ * All the state is only touched from m_strand, where the callbacks are
+ * invoked too: pass the strand of the owner to get them there.
+ */
+class Channel : public std::enable_shared_from_this<Channel> {
+  public:
+    typedef std::shared_ptr<Channel> Ptr;
+    typedef std::function<void(const error_code &, const Response &)>
+        ResponseCallback;
+
+  private:
+    struct PendingRequest {
+        ResponseCallback callback;
+        std::unique_ptr<steady_timer> timeout;
+    };
+
+    struct QueuedCmd {
+        SharedCmd::Ptr cmd;
+        uint32_t requestId;
+    };
+
+    io_context &m_io;
+    Strand m_strand;
+    const local::stream_protocol::endpoint m_endpoint;
+    const Framing m_framing;
+    const Encoding m_encoding;
+    Connection::Ptr m_connection{nullptr};
+    bool m_isConnected{false};
+    uint32_t m_nextRequestId{1};
+    std::unordered_map<uint32_t, PendingRequest> m_pending;
+    // written as soon as the connection is established
+    std::vector<QueuedCmd> m_waitingForConnection;
+
+    void doSendCmd(SharedCmd::Ptr &&cmd, ResponseCallback &&cb,
+                   const steady_timer::duration &timeout);
+    void connect();
+    void onConnect(const error_code &, Connection::Ptr connection);
+    void write(const QueuedCmd &queued);
+    void readResponses();
+    void onResponse(const Connection::Ptr &connection, const error_code &,
+                    const Response &response);
+    void complete(uint32_t requestId, const error_code &,
+                  const Response &response);
+    void failAll(const error_code &);
+    void sendOnNewConnection(const SharedCmd::Ptr &cmd, ResponseCallback &&cb,
+                             const steady_timer::duration &timeout);
+
+  public:
+    Channel(io_context &io, const Strand &strand,
+            local::stream_protocol::endpoint endpoint, Framing framing,
+            Encoding encoding = Encoding::Json);
+    ~Channel();
+    static Ptr create(io_context &io, const Strand &strand,
+                      const local::stream_protocol::endpoint &endpoint,
+                      Framing framing, Encoding encoding = Encoding::Json);
+
+    void asyncSendCmd(
+        Cmd cmd, ResponseCallback &&cb,
+        const steady_timer::duration &timeout = std::chrono::seconds(3));
+    // the same cmd may be sent to many channels, and is only encoded once
+    void asyncSendCmd(
+        SharedCmd::Ptr cmd, ResponseCallback &&cb,
+        const steady_timer::duration &timeout = std::chrono::seconds(3));
+    void close();
+
+    const local::stream_protocol::endpoint &endpoint() const;
+    Framing framing() const;
+    Encoding encoding() const;
+    size_t inFlight() const;
+};
+
+// one Channel per socket path. Not thread safe: use it from the strand given
+// to the channels
+class ChannelPool {
+  private:
+    io_context &m_io;
+    Strand m_strand;
+    const Framing m_framing;
+    const Encoding m_encoding;
+    std::unordered_map<std::string, Channel::Ptr> m_channels;
+
+  public:
+    ChannelPool(io_context &io, const Strand &strand, Framing framing,
+                Encoding encoding = Encoding::Json);
+    ~ChannelPool();
+
+    Channel::Ptr get(const local::stream_protocol::endpoint &endpoint);
+    void remove(const local::stream_protocol::endpoint &endpoint);
+    void closeAll();
+};
+} // namespace kekmonitors
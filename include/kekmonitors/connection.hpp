@@ -3,11 +3,16 @@
 //
 
 #pragma once
+#include <atomic>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/local/stream_protocol.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <deque>
 #include <kekmonitors/core.hpp>
+#include <kekmonitors/frame.hpp>
 #include <kekmonitors/msg.hpp>
+#include <mutex>
 
 using namespace boost::asio;
 
@@ -19,20 +24,108 @@ typedef std::function<void(const error_code &, const Cmd &,
 class Connection : public std::enable_shared_from_this<Connection> {
   public:
     typedef std::shared_ptr<Connection> Ptr;
+    typedef std::function<void(const error_code &, Ptr)> WriteCallback;
+
+    // how long a persistent (framed) connection may stay without traffic
+    static const steady_timer::duration s_idleTimeout;
 
   private:
+    struct OutgoingMessage {
+        FrameHeader::Bytes header;
+        std::string data;
+        // written instead of data when set, see SharedCmd
+        SharedCmd::Bytes sharedData;
+        WriteCallback callback;
+
+        const std::string &bytes() const {
+            return sharedData ? *sharedData : data;
+        }
+    };
+
     io_context &m_io;
+    // every handler of this connection runs here: reads, writes and the
+    // timeout may complete on different threads
+    Strand m_strand;
+    // atomic: both are updated by reads and looked at by writers, which
+    // serialize before getting on the strand
+    std::atomic<Framing> m_framing;
+    // used for outgoing frames. It follows the encoding of the frames
+    // received, so the accepting side answers in whatever the client chose.
+    std::atomic<Encoding> m_encoding{Encoding::Json};
+    // holds exactly the bytes of the last message read, reused across reads
     std::vector<char> m_buffer;
+    FrameHeader::Bytes m_readHeader{};
+    uint32_t m_readRequestId{0};
+    Encoding m_readEncoding{Encoding::Json};
+    // only one async_write may be pending at a time: the rest waits here.
+    // the first m_writing elements are the ones being written, all in the
+    // same gathered write
+    std::deque<OutgoingMessage> m_writeQueue;
+    size_t m_writing{0};
+    // the data of written messages, cleared but with their capacity, which
+    // the next messages are serialized into. Writers serialize before getting
+    // on the strand, hence the mutex
+    std::mutex m_spareBuffersMutex;
+    std::vector<std::string> m_spareBuffers;
     steady_timer m_timeout;
+    // the timeout of the pending read, if any. It only runs while no request
+    // is in flight: a slow handler must not get its connection closed
+    // before it answers
+    steady_timer::duration m_readTimeout{};
+    bool m_reading{false};
+    size_t m_inFlight{0};
+
+    // buffers kept in m_spareBuffers, and the largest capacity kept: a huge
+    // message must not hold on to its memory for the life of the connection
+    static const size_t s_maxSpareBuffers;
+    static const size_t s_maxSpareBufferCapacity;
+    // messages gathered in a single write: two buffers each, which asio
+    // passes to one writev as long as they're at most 64
+    static const size_t s_maxWriteBatch;
 
     void onTimeout(const error_code &);
+    void armTimeout();
+    void asyncReadMessage(std::function<void(const error_code &)> &&,
+                          const steady_timer::duration &timeout);
+    void readUntilEof(const std::function<void(const error_code &)> &);
+    void readFrame(size_t headerOffset,
+                   const std::function<void(const error_code &)> &);
+    void onReadComplete(const error_code &,
+                        const std::function<void(const error_code &)> &);
+    Encoding writeEncoding() const;
+    // an empty string from m_spareBuffers, or a new one
+    std::string takeBuffer();
+    void recycleBuffer(std::string &&buffer);
+    void asyncWriteMessage(std::string &&message, uint32_t requestId,
+                           Encoding encoding, WriteCallback &&);
+    void asyncWriteMessage(SharedCmd::Bytes message, uint32_t requestId,
+                           Encoding encoding, WriteCallback &&);
+    // on m_strand
+    void queueMessage(OutgoingMessage &&message);
+    // writes as many queued messages as possible at once
+    void writeQueuedMessages();
+    void doClose();
 
   public:
     local::stream_protocol::socket p_endpoint;
 
-    explicit Connection(io_context &);
+    explicit Connection(io_context &, Framing framing = Framing::Eof);
     ~Connection();
-    static Ptr create(io_context &);
+    static Ptr create(io_context &, Framing framing = Framing::Eof);
+
+    Framing framing() const;
+    void setFraming(Framing framing);
+    Encoding encoding() const;
+    // only honored by framed connections, Eof ones always use json
+    void setEncoding(Encoding encoding);
+    // the callbacks passed to the async functions are invoked on this strand
+    const Strand &strand() const;
+    // thread safe, unlike p_endpoint.close()
+    void close();
+    // a request read from this connection is being handled / was answered:
+    // the idle timeout of the next read waits until none is left
+    void requestStarted();
+    void requestDone();
 
     void asyncReadCmd(
         const CmdCallback &&,
@@ -40,8 +133,19 @@ class Connection : public std::enable_shared_from_this<Connection> {
     void
     asyncWriteResponse(const Response &,
                        const std::function<void(const error_code &, Ptr)> &&);
+    void
+    asyncWriteResponse(const Response &, uint32_t requestId,
+                       const std::function<void(const error_code &, Ptr)> &&);
+    // answers in the encoding of the Cmd, see Cmd::encoding(): by the time
+    // the response is written, the connection may have read other frames
+    void
+    asyncWriteResponse(const Response &, uint32_t requestId, Encoding encoding,
+                       const std::function<void(const error_code &, Ptr)> &&);
     void asyncWriteCmd(const Cmd &,
                        std::function<void(const error_code &, Ptr)> &&);
+    // writes the bytes shared with the other connections the cmd is sent to
+    void asyncWriteCmd(const SharedCmd::Ptr &, uint32_t requestId,
+                       std::function<void(const error_code &, Ptr)> &&);
     void asyncReadResponse(
         std::function<void(const error_code &, const Response &, Ptr)> &&,
         const steady_timer::duration &timeout = std::chrono::seconds(3));
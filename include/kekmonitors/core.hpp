@@ -1,4 +1,6 @@
 #pragma once
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/bimap.hpp>
 #include <boost/system/error_code.hpp>
 #include <mongocxx/instance.hpp>
@@ -13,13 +15,19 @@
 #define KEKMONITORS_DEBUG
 #endif
 
+// KDBG("format {}", args...): the arguments are only evaluated if the debug
+// logger is enabled, and not even compiled without KEKMONITORS_DEBUG
 #ifdef KEKMONITORS_DEBUG
-#define KDBG(x)                                                                \
+#define KDBG(format, ...)                                                      \
     do {                                                                       \
-        spdlog::get("KDBG")->debug("[{}] {}", __FUNCTION__, x);                \
+        spdlog::logger *kdbgLogger = kekmonitors::debugLogger();               \
+        if (kdbgLogger && kdbgLogger->should_log(spdlog::level::debug))        \
+            kdbgLogger->debug("[{}] " format, __FUNCTION__, ##__VA_ARGS__);    \
     } while (0)
 #else
-#define KDBG(x)
+#define KDBG(format, ...)                                                      \
+    do {                                                                       \
+    } while (0)
 #endif
 
 #define REGISTER_COMMAND(cmd)                                                  \
@@ -29,8 +37,17 @@
     kekmonitors::errorStringMap().insert(kekmonitors::ErrorStringValue(        \
         err, kekmonitors::utils::getStringWithoutNamespaces(#err)))
 
-#define KEKMONITORS_FIRST_CUSTOM_COMMAND                                       \
-    (kekmonitors::COMMANDS::MM_GET_SCRAPER_SHOES + 1)
+// part of the wire protocol: custom commands must keep their ids, so this
+// never moves. Builtin commands added after it go in the reserved block
+#define KEKMONITORS_FIRST_CUSTOM_COMMAND 50u
+// builtin commands at the top of the id space, not available to custom ones
+#define KEKMONITORS_FIRST_RESERVED_COMMAND 0xFFFF0000u
+#define KEKMONITORS_LAST_RESERVED_COMMAND                                      \
+    (kekmonitors::COMMANDS::MM_GET_METRICS)
+// builtin commands in total, see builtinCommandIndex()
+#define KEKMONITORS_BUILTIN_COMMANDS                                           \
+    (KEKMONITORS_LAST_RESERVED_COMMAND - KEKMONITORS_FIRST_RESERVED_COMMAND + \
+     KEKMONITORS_FIRST_CUSTOM_COMMAND + 1)
 #define KEKMONITORS_FIRST_CUSTOM_ERROR (kekmonitors::ERRORS::UNKNOWN_ERROR + 1)
 
 namespace kekmonitors {
@@ -46,6 +63,9 @@ namespace ph = std::placeholders;
 typedef uint32_t CommandType;
 typedef uint32_t ErrorType;
 typedef boost::system::error_code error_code;
+// serializes the handlers of an object when io_context::run() is called from
+// more than one thread
+typedef boost::asio::strand<boost::asio::io_context::executor_type> Strand;
 
 enum COMMANDS : CommandType {
     PING = 1,
@@ -98,8 +118,48 @@ enum COMMANDS : CommandType {
     MM_SET_MONITOR_SCRAPER_CONFIG,
     MM_GET_MONITOR_SHOES,
     MM_GET_SCRAPER_SHOES,
+
+    // KEKMONITORS_FIRST_RESERVED_COMMAND onwards
+    MM_ADD_MONITORS = KEKMONITORS_FIRST_RESERVED_COMMAND,
+    MM_ADD_SCRAPERS,
+    MM_STOP_MONITORS,
+    MM_STOP_SCRAPERS,
+    // payload: {"name": shm object, "generation": N}, see snapshot.hpp
+    CONFIG_SNAPSHOT_UPDATED,
+    MM_GET_CONFIG_PUSHES,
+    MM_GET_METRICS,
 };
 
+static_assert(COMMANDS::MM_GET_SCRAPER_SHOES + 1 ==
+                  KEKMONITORS_FIRST_CUSTOM_COMMAND,
+              "builtin commands must be added to the reserved block");
+
+// builtin commands numbered contiguously from 0, to index tables by them.
+// KEKMONITORS_BUILTIN_COMMANDS if cmd is not a builtin command
+constexpr size_t builtinCommandIndex(CommandType cmd) {
+    if (cmd < KEKMONITORS_FIRST_CUSTOM_COMMAND)
+        return cmd;
+    if (cmd >= KEKMONITORS_FIRST_RESERVED_COMMAND &&
+        cmd <= KEKMONITORS_LAST_RESERVED_COMMAND)
+        return KEKMONITORS_FIRST_CUSTOM_COMMAND + cmd -
+               KEKMONITORS_FIRST_RESERVED_COMMAND;
+    return KEKMONITORS_BUILTIN_COMMANDS;
+}
+
+// the opposite of builtinCommandIndex()
+constexpr CommandType builtinCommand(size_t index) {
+    return index < KEKMONITORS_FIRST_CUSTOM_COMMAND
+               ? static_cast<CommandType>(index)
+               : static_cast<CommandType>(KEKMONITORS_FIRST_RESERVED_COMMAND +
+                                          index -
+                                          KEKMONITORS_FIRST_CUSTOM_COMMAND);
+}
+
+constexpr bool isCustomCommand(CommandType cmd) {
+    return cmd >= KEKMONITORS_FIRST_CUSTOM_COMMAND &&
+           cmd < KEKMONITORS_FIRST_RESERVED_COMMAND;
+}
+
 enum ERRORS : ErrorType {
     OK = 0,
 
@@ -130,6 +190,10 @@ enum ERRORS : ErrorType {
 
 enum class MonitorOrScraper { Monitor = 0, Scraper };
 
+// how a message is serialized on the wire. Only framed connections can use
+// something other than Json, see FrameHeader.
+enum class Encoding : uint8_t { Json = 0, MessagePack, Cbor };
+
 typedef boost::bimap<CommandType, std::string> CommandStringMap;
 typedef CommandStringMap::value_type CommandStringValue;
 typedef boost::bimap<ErrorType, std::string> ErrorStringMap;
@@ -139,6 +203,8 @@ CommandStringMap &commandStringMap();
 ErrorStringMap &errorStringMap();
 
 void initDebugLogger();
+// the logger used by KDBG, nullptr before initDebugLogger
+spdlog::logger *debugLogger();
 void initMaps();
 mongocxx::instance &initDbInstance();
 void init();
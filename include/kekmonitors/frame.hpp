@@ -0,0 +1,53 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <kekmonitors/core.hpp>
+
+namespace kekmonitors {
+
+enum class Framing {
+    // raw message, terminated by the peer's shutdown_send (python monitors)
+    Eof = 0,
+    // FrameHeader followed by exactly FrameHeader::p_length bytes
+    LengthPrefixed,
+    // server side only: choose one of the above looking at the first byte
+    Detect
+};
+
+/*
+ * Wire layout (12 bytes, integers in network byte order):
+ *  [0]     magic, s_magic
+ *  [1]     version, s_version
+ *  [2]     flags: the lowest 2 bits are the Encoding of the payload
+ *  [3]     reserved
+ *  [4..7]  payload length
+ *  [8..11] request id, echoed back in the response so that many requests
+ *          can be in flight on the same connection
+ * A json message can never start with s_magic, which is what allows
+ * Framing::Detect to tell the two formats apart.
+ */
+class FrameHeader {
+  public:
+    static constexpr uint8_t s_magic = 'K';
+    static constexpr uint8_t s_version = 1;
+    static constexpr size_t s_size = 12;
+    static constexpr uint32_t s_maxLength = 64 * 1024 * 1024;
+    static constexpr uint8_t s_encodingMask = 0x03;
+
+    typedef std::array<char, s_size> Bytes;
+
+    uint8_t p_flags{0};
+    uint32_t p_length{0};
+    uint32_t p_requestId{0};
+
+    FrameHeader() = default;
+    FrameHeader(uint32_t length, uint32_t requestId)
+        : p_length(length), p_requestId(requestId){};
+
+    Encoding encoding() const;
+    void setEncoding(Encoding encoding);
+
+    Bytes encode() const;
+    static FrameHeader decode(const Bytes &bytes, error_code &ec);
+};
+} // namespace kekmonitors
@@ -27,6 +27,7 @@
 
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/strand.hpp>
 #include <deque>
 #include <map>
 #include <stdint.h>
@@ -463,6 +464,18 @@ class Inotify {
      */
     Inotify(boost::asio::io_context &) noexcept(false);
 
+    /// Constructor.
+    /**
+     * Same as above, but the asynchronous event handling (including the
+     * callback given to AsyncStartWaitForEvents()) runs on the given strand,
+     * which must also be used for any other access to this object.
+     *
+     * 	hrow InotifyException thrown if inotify isn't available
+     */
+    Inotify(boost::asio::io_context &,
+            const boost::asio::strand<boost::asio::io_context::executor_type>
+                &) noexcept(false);
+
     /// Destructor.
     /**
      * Calls Close() due to clean-up.
@@ -781,6 +794,7 @@ class Inotify {
   private:
     int m_fd; ///< file descriptor
     boost::asio::posix::stream_descriptor m_afd;
+    boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
     std::function<void()> m_event_callback;
     IN_WATCH_MAP m_watches;              ///< watches (by descriptors)
     IN_WP_MAP m_paths;                   ///< watches (by paths)
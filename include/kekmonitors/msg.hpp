@@ -1,5 +1,9 @@
 #pragma once
+#include <array>
+#include <boost/asio/buffer.hpp>
 #include <kekmonitors/core.hpp>
+#include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
 
@@ -13,10 +17,26 @@ class IMessage {
     virtual std::string toString() const = 0;
 };
 
+// fills Cmd and Response from json text with simdjson, see msg.cpp
+struct LazyJsonDecoder;
+
 class Cmd : public IMessage {
+    friend struct LazyJsonDecoder;
+
   protected:
     kekmonitors::CommandType m_cmd;
-    json m_payload;
+    // parsed from m_rawPayload by the first call to payload()
+    mutable json m_payload;
+    // json text of the payload not parsed yet. Only set when decoding json
+    // with simdjson (KEKMONITORS_SIMDJSON), empty otherwise
+    mutable std::string m_rawPayload;
+    // set by payload() if nlohmann refuses m_rawPayload, which simdjson
+    // validated already
+    mutable error_code m_payloadError;
+    // carried in the frame header, not in the json message
+    uint32_t m_requestId{0};
+    // the one it was received in, which the response must use too
+    Encoding m_encoding{Encoding::Json};
 
   public:
     Cmd();
@@ -24,22 +44,79 @@ class Cmd : public IMessage {
 
     static Cmd fromJson(const json &obj);
     static Cmd fromJson(const json &obj, error_code &ec);
+    // moves the payload out of obj instead of copying it
+    static Cmd fromJson(json &&obj, error_code &ec);
     json toJson() const override;
     static Cmd fromString(const std::string &str);
     static Cmd fromString(const std::string &str, error_code &ec);
+    // parse only [data, data + size), without copying it first
+    static Cmd fromString(const char *data, size_t size, error_code &ec);
+    static Cmd fromString(const boost::asio::const_buffer &buffer,
+                          error_code &ec);
+    static Cmd fromString(const char *data, size_t size, Encoding encoding,
+                          error_code &ec);
     std::string toString() const override;
+    std::string toString(Encoding encoding) const;
+    // appends the same bytes as toString(encoding) to out, without building
+    // the json of the whole message first. Like toJson(), throws
+    // std::invalid_argument if the payload isn't valid json (see
+    // payloadError()): it's never written back as it was received
+    void serialize(std::string &out, Encoding encoding) const;
 
     kekmonitors::CommandType cmd() const;
     void setCmd(kekmonitors::CommandType cmd);
+    // parses the raw payload if there is one, so it must not be called from
+    // different threads at the same time. Null if it isn't valid json
     const json &payload() const;
+    // invalid_argument if the payload received isn't valid json. Parses it
+    // like payload()
+    const error_code &payloadError() const;
     void setPayload(const json &payload);
+    void setPayload(json &&payload);
+    uint32_t requestId() const;
+    void setRequestId(uint32_t requestId);
+    Encoding encoding() const;
+    void setEncoding(Encoding encoding);
+};
+
+/*
+ * An immutable Cmd written to many connections, like a config pushed to every
+ * monitor: it's serialized once per encoding, by the first connection that
+ * needs it, and the others write the same bytes. Only the frame headers,
+ * which carry the request ids, differ.
+ */
+class SharedCmd {
+  public:
+    typedef std::shared_ptr<const SharedCmd> Ptr;
+    typedef std::shared_ptr<const std::string> Bytes;
+
+  private:
+    const Cmd m_cmd;
+    // indexed by Encoding
+    mutable std::array<std::once_flag, 3> m_encodedOnce;
+    mutable std::array<Bytes, 3> m_encoded;
+
+  public:
+    explicit SharedCmd(Cmd cmd);
+    static Ptr create(Cmd cmd);
+
+    const Cmd &cmd() const;
+    // thread safe
+    const Bytes &encoded(Encoding encoding) const;
 };
 
 class Response : public IMessage {
+    friend struct LazyJsonDecoder;
+
   private:
     kekmonitors::ErrorType m_error;
     std::string m_info;
-    json m_payload;
+    // same as in Cmd
+    mutable json m_payload;
+    mutable std::string m_rawPayload;
+    mutable error_code m_payloadError;
+    // carried in the frame header, not in the json message
+    uint32_t m_requestId{0};
 
   public:
     Response();
@@ -47,17 +124,34 @@ class Response : public IMessage {
 
     static Response fromJson(const json &obj);
     static Response fromJson(const json &obj, error_code &ec);
+    // moves the payload and info out of obj instead of copying them
+    static Response fromJson(json &&obj, error_code &ec);
     json toJson() const override;
     static Response fromString(const std::string &str);
     static Response fromString(const std::string &str, error_code &ec);
+    // parse only [data, data + size), without copying it first
+    static Response fromString(const char *data, size_t size,
+                               error_code &ec);
+    static Response fromString(const boost::asio::const_buffer &buffer,
+                               error_code &ec);
+    static Response fromString(const char *data, size_t size,
+                               Encoding encoding, error_code &ec);
     std::string toString() const override;
+    std::string toString(Encoding encoding) const;
+    // same as Cmd::serialize()
+    void serialize(std::string &out, Encoding encoding) const;
 
     kekmonitors::ErrorType error() const;
     void setError(kekmonitors::ErrorType error);
+    // same as Cmd::payload() and Cmd::payloadError()
     const json &payload() const;
+    const error_code &payloadError() const;
     void setPayload(const json &payload);
+    void setPayload(json &&payload);
     const std::string &info() const;
     void setInfo(const std::string &info);
+    uint32_t requestId() const;
+    void setRequestId(uint32_t requestId);
 
     static Response okResponse();
     static Response badResponse();
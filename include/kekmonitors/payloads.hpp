@@ -0,0 +1,193 @@
+#pragma once
+#include <kekmonitors/msg.hpp>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace kekmonitors {
+
+/*
+ * Typed payloads of the commands handled by the MonitorManager. Every struct
+ * lists its fields once in fields(), from which parsePayload and toPayload are
+ * generated: lookups are done with find() and explicit type checks, nothing
+ * throws on a missing or mistyped field.
+ * A handler taking one of these instead of the Cmd gets it already parsed,
+ * see CmdDispatcher.
+ */
+
+template <typename T, typename V> struct PayloadField {
+    const char *p_name;
+    V T::*p_member;
+};
+
+template <typename T, typename V>
+constexpr PayloadField<T, V> payloadField(const char *name, V T::*member) {
+    return {name, member};
+}
+
+// {"name": "..."}
+struct NamePayload {
+    std::string p_name;
+
+    static constexpr auto fields() {
+        return std::make_tuple(payloadField("name", &NamePayload::p_name));
+    }
+};
+
+// {"names": [...]}, or "names" as a comma separated string for the cli
+struct NamesPayload {
+    std::vector<std::string> p_names;
+
+    static constexpr auto fields() {
+        return std::make_tuple(payloadField("names", &NamesPayload::p_names));
+    }
+};
+
+// optional {"last": n}
+struct ConfigPushesPayload {
+    std::optional<size_t> p_last;
+
+    static constexpr auto fields() {
+        return std::make_tuple(
+            payloadField("last", &ConfigPushesPayload::p_last));
+    }
+};
+
+namespace payload {
+
+// false if value is not of the type of out. description completes "must be"
+inline bool read(const json &value, std::string &out) {
+    if (!value.is_string())
+        return false;
+    out = value.get_ref<const std::string &>();
+    return true;
+}
+inline const char *description(const std::string &) { return "a string"; }
+
+inline bool read(const json &value, size_t &out) {
+    if (!value.is_number_unsigned())
+        return false;
+    out = value.get<size_t>();
+    return true;
+}
+inline const char *description(const size_t &) {
+    return "a non negative integer";
+}
+
+inline bool read(const json &value, std::vector<std::string> &out) {
+    out.clear();
+    if (value.is_string()) {
+        std::istringstream stream{value.get_ref<const std::string &>()};
+        std::string item;
+        while (std::getline(stream, item, ','))
+            out.push_back(item);
+        return true;
+    }
+    if (!value.is_array())
+        return false;
+    out.reserve(value.size());
+    for (const auto &item : value) {
+        if (!item.is_string())
+            return false;
+        out.push_back(item.get<std::string>());
+    }
+    return true;
+}
+inline const char *description(const std::vector<std::string> &) {
+    return "a list of strings";
+}
+
+template <typename V> bool isRequired(const V &) { return true; }
+template <typename V> bool isRequired(const std::optional<V> &) {
+    return false;
+}
+
+template <typename V> bool readField(const json &value, V &out) {
+    return read(value, out);
+}
+template <typename V>
+bool readField(const json &value, std::optional<V> &out) {
+    V v;
+    if (!read(value, v))
+        return false;
+    out = std::move(v);
+    return true;
+}
+
+template <typename V> const char *fieldDescription(const V &v) {
+    return description(v);
+}
+template <typename V>
+const char *fieldDescription(const std::optional<V> &) {
+    return description(V{});
+}
+
+template <typename V>
+void writeField(json &obj, const char *name, const V &v) {
+    obj[name] = v;
+}
+template <typename V>
+void writeField(json &obj, const char *name, const std::optional<V> &v) {
+    if (v)
+        obj[name] = *v;
+}
+
+template <typename T, typename Field>
+bool parseField(const json &obj, const Field &field, T &out,
+                Response &response) {
+    auto &member = out.*(field.p_member);
+    // find() on null is end() too
+    const auto it = obj.find(field.p_name);
+    if (it == obj.end()) {
+        if (!isRequired(member))
+            return true;
+        if (obj.is_null())
+            response.setError(ERRORS::MISSING_PAYLOAD);
+        else {
+            response.setError(ERRORS::MISSING_PAYLOAD_ARGS);
+            response.setInfo(std::string{"Missing payload arg: \""} +
+                             field.p_name + "\".");
+        }
+        return false;
+    }
+    if (!readField(*it, member)) {
+        response.setError(ERRORS::BAD_PAYLOAD);
+        response.setInfo(std::string{"\""} + field.p_name + "\" must be " +
+                         fieldDescription(member) + ".");
+        return false;
+    }
+    return true;
+}
+} // namespace payload
+
+// fills out from the payload of a Cmd. On error fills response with
+// MISSING_PAYLOAD, MISSING_PAYLOAD_ARGS or BAD_PAYLOAD and returns false
+template <typename T>
+bool parsePayload(const json &obj, T &out, Response &response) {
+    if (!obj.is_null() && !obj.is_object()) {
+        response.setError(ERRORS::BAD_PAYLOAD);
+        response.setInfo("The payload must be an object.");
+        return false;
+    }
+    // stops at the first field that fails
+    return std::apply(
+        [&](const auto &...fields) {
+            return (payload::parseField(obj, fields, out, response) && ...);
+        },
+        T::fields());
+}
+
+template <typename T> json toPayload(const T &value) {
+    json obj = json::object();
+    std::apply(
+        [&](const auto &...fields) {
+            (payload::writeField(obj, fields.p_name,
+                                 value.*(fields.p_member)),
+             ...);
+        },
+        T::fields());
+    return obj;
+}
+} // namespace kekmonitors
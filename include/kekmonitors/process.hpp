@@ -3,37 +3,80 @@
 //
 
 #pragma once
-#include <boost/process.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <ctime>
 #include <kekmonitors/core.hpp>
-#include <kekmonitors/utils.hpp>
 #include <nlohmann/json.hpp>
+#include <sys/types.h>
+#include <vector>
 
 namespace kekmonitors {
 
+/*
+ * A child process started with posix_spawn, with stdout and stderr sent to
+ * /dev/null. Its exit is noticed through a pidfd (or by polling on kernels
+ * without pidfd_open) and reported to the exit callback on the given strand,
+ * which must also be the only one using the object.
+ */
 class Process {
+  public:
+    // exit code, or 128 + signal number if the process was killed
+    typedef std::function<void(int, const std::error_code &)> ExitCallback;
+
   private:
+    static const boost::asio::steady_timer::duration s_pollInterval;
+
     const std::string m_className{};
-    boost::process::child m_process;
     const std::time_t m_creation = 0;
+    Strand m_strand;
+    pid_t m_pid{-1};
+    bool m_exited{false};
+    boost::asio::posix::stream_descriptor m_pidfd;
+    boost::asio::steady_timer m_pollTimer;
+    ExitCallback m_onExit;
+
+    void waitForExit();
+    void pollForExit();
+    // the process was reaped by reapUntracked() before being adopted
+    void onReaped(int status);
+    void onExit(int status);
 
   public:
-    Process() = default;
-    template <typename... Args>
-    Process(std::string className, Args &&... processArgs)
-        : m_className(std::move(className)),
-          m_process(std::forward<Args>(processArgs)...),
-          m_creation(std::time(nullptr)) {
-        KDBG("Constructed process");
-    };
+    typedef std::unique_ptr<Process> Ptr;
+
+    Process(boost::asio::io_context &io, const Strand &strand,
+            std::string className, ExitCallback &&onExit);
+    // like boost::process::child, a process that is still running is killed
+    ~Process();
+
+    // argv[0] is executable. stdinFd, if any, becomes the stdin of the
+    // process. Returns nullptr and sets ec if the process couldn't be started
+    static Ptr create(boost::asio::io_context &io, const Strand &strand,
+                      std::string className, const std::string &executable,
+                      const std::vector<std::string> &args,
+                      ExitCallback &&onExit, std::error_code &ec,
+                      int stdinFd = -1);
+    // tracks a process started by someone else. It must be a child of this
+    // process (see Zygote) for its exit code to be collected
+    static Ptr adopt(boost::asio::io_context &io, const Strand &strand,
+                     std::string className, pid_t pid, ExitCallback &&onExit);
 
-    ~Process() { KDBG("Destroyed process"); }
+    // reaps the exited children that no Process tracks, like the ones
+    // orphaned by the scripts of the Zygote. Returns false if a tracked child
+    // exited but its Process hasn't reaped it yet: the children after it are
+    // only seen once it has
+    static bool reapUntracked();
 
     std::time_t creation() const { return m_creation; };
-    boost::process::child &process() { return m_process; };
+    pid_t id() const { return m_pid; }
+    bool running() const;
+    // SIGKILL, then reaps the process: the exit callback isn't called
+    void terminate();
     nlohmann::json toJson() const {
-        return {{"Started at", m_creation}, {"PID", m_process.id()}};
+        return {{"Started at", m_creation}, {"PID", m_pid}};
     };
     const std::string &classname() const { return m_className; }
 };
-} // namespace kekmonitors
\ No newline at end of file
+} // namespace kekmonitors
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <kekmonitors/core.hpp>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <system_error>
+
+namespace kekmonitors {
+
+/*
+ * The parsed config files, published by MonitorManager in POSIX shared memory
+ * so that processes can map them read-only instead of receiving each change
+ * over their socket.
+ * The object called name only holds a ConfigSnapshotHeader with the current
+ * generation. Generation N lives in its own object, name + "." + N, which is
+ * never modified once published: a ConfigSnapshotData followed by the
+ * msgpack encoded payload
+ *     {"common": {"configs": {...}, "whitelists": {...}, ...},
+ *      "monitors": {...}, "scrapers": {...}}
+ * The previous generation is unlinked when a new one is published: a reader
+ * that can't find the generation it just read from the header only has to
+ * read the header again.
+ */
+struct ConfigSnapshotHeader {
+    static constexpr uint64_t s_magic = 0x464e4f434b454bULL; // "KEKCONF"
+    static constexpr uint32_t s_layoutVersion = 1;
+
+    uint64_t magic;
+    uint32_t layoutVersion;
+    uint32_t reserved;
+    // 0 if nothing was published yet
+    std::atomic<uint64_t> generation;
+};
+
+struct ConfigSnapshotData {
+    uint64_t magic;
+    uint64_t generation;
+    // of the payload
+    Encoding encoding;
+    uint8_t reserved[7];
+    uint64_t size;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the generation is shared between processes");
+
+// name of the object holding generation
+std::string configSnapshotDataName(const std::string &name,
+                                   uint64_t generation);
+
+class ConfigSnapshotPublisher {
+  private:
+    const std::string m_name;
+    ConfigSnapshotHeader *m_header{nullptr};
+    uint64_t m_generation{0};
+
+  public:
+    explicit ConfigSnapshotPublisher(std::string name);
+    // the objects are left in place: processes can still read the last
+    // snapshot while MonitorManager is restarting
+    ~ConfigSnapshotPublisher();
+
+    // creates or reuses the header, the generation carries on from there
+    bool open(std::error_code &ec);
+    // returns the new generation, or 0 and sets ec
+    uint64_t publish(const nlohmann::json &snapshot, std::error_code &ec);
+    uint64_t generation() const { return m_generation; }
+    const std::string &name() const { return m_name; }
+};
+
+// reads the current snapshot of name. Returns false and sets ec if there is
+// none or it couldn't be read
+bool readConfigSnapshot(const std::string &name, nlohmann::json &snapshot,
+                        uint64_t &generation, std::error_code &ec);
+} // namespace kekmonitors
@@ -0,0 +1,28 @@
+#pragma once
+#include <algorithm>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+namespace kekmonitors {
+
+// {"p50_us", "p99_us", "p999_us", "max_us", "mean_us"} of latencies in ns,
+// reported the same way by the benchmarks and momanbench
+inline nlohmann::json latencyStats(std::vector<double> latencies) {
+    if (latencies.empty())
+        return nlohmann::json::object();
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](double p) {
+        const size_t index = std::min(
+            latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+        return latencies[index] / 1000;
+    };
+    double sum = 0;
+    for (const auto latency : latencies)
+        sum += latency;
+    return {{"p50_us", percentile(0.5)},
+            {"p99_us", percentile(0.99)},
+            {"p999_us", percentile(0.999)},
+            {"max_us", latencies.back() / 1000},
+            {"mean_us", sum / latencies.size() / 1000}};
+}
+} // namespace kekmonitors
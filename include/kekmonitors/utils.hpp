@@ -5,6 +5,7 @@
 #include <pwd.h>
 #include <spdlog/spdlog.h>
 #include <string>
+#include <vector>
 
 namespace kekmonitors::utils {
 
@@ -26,9 +27,19 @@ std::string getStringWithoutNamespaces(const std::string &command);
 
 std::string getStringWithoutNamespaces(CommandType command);
 
+// absolute path of GlobalConfig.python_executable, or of the first python 3
+// in PATH if that is empty. Cached once found, empty if not found.
 fs::path getPythonExecutable();
 
+// same semantics as python's ConfigParser.getboolean, used by the monitors
+bool getConfigBool(const std::string &key, bool defaultValue);
+
 Response makeCommonResponse(const Response &firstResponse,
                             const Response &secondResponse,
                             const ERRORS commonError = ERRORS::UNKNOWN_ERROR);
+
+// the payload maps every name to {"error", "info"} of its response
+Response makeBatchResponse(const std::vector<std::string> &names,
+                           const std::vector<Response> &responses,
+                           const ERRORS commonError = ERRORS::UNKNOWN_ERROR);
 } // namespace kekmonitors::utils
@@ -16,10 +16,10 @@ int main(int argc, char *argv[]) {
     initMaps();
     initDebugLogger();
     if (!std::strcmp(argv[1], "--list-cmd")) {
-        for (CommandType i = COMMANDS::PING;
-             i < KEKMONITORS_FIRST_CUSTOM_COMMAND; i++) {
-            const auto commandString =
-                utils::getStringWithoutNamespaces(utils::commandToString(i));
+        for (size_t i = COMMANDS::PING; i < KEKMONITORS_BUILTIN_COMMANDS;
+             i++) {
+            const auto commandString = utils::getStringWithoutNamespaces(
+                utils::commandToString(builtinCommand(i)));
             if (commandString.substr(0, 2) == "MM")
                 std::cout << commandString << "\n";
         }
@@ -32,7 +32,7 @@ int main(int argc, char *argv[]) {
         command = utils::stringToCommand(argv[1]);
     } catch (std::out_of_range &) {
         try {
-            command = static_cast<CommandType>(std::stoi(argv[1]));
+            command = static_cast<CommandType>(std::stoul(argv[1]));
         } catch (std::invalid_argument &) {
             std::cerr << "argv[2] is not a number nor a valid command"
                       << std::endl;
@@ -66,7 +66,7 @@ int main(int argc, char *argv[]) {
     auto logger = utils::getLogger("MomanCli");
     Config cfg;
     io_context io;
-    auto connection = Connection::create(io);
+    auto connection = Connection::create(io, Framing::LengthPrefixed);
     connection->p_endpoint.async_connect(
         local::stream_protocol::endpoint(
             cfg.p_parser.get<std::string>("GlobalConfig.socket_path") +
@@ -1,17 +1,22 @@
 #include "moman.hpp"
+#include <algorithm>
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/error.hpp>
-#include <boost/process/detail/on_exit.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/system/detail/errc.hpp>
 #include <functional>
-#include <mongocxx/exception/query_exception.hpp>
+#include <iterator>
+#include <kekmonitors/utils.hpp>
+#include <mutex>
+#include <unordered_set>
 
 namespace kekmonitors {
 
 MonitorScraperCompletion::MonitorScraperCompletion(
-    io_context &io, MonitorManager *moman, Cmd cmd,
+    const Strand &strand, MonitorManager *moman,
     MonitorManagerCallback &&momanCb, DoubleResponseCallback &&completionCb,
     Connection::Ptr connection)
-    : m_io(io), m_cmd(std::move(cmd)), m_completionCb(std::move(completionCb)),
+    : m_strand(strand), m_completionCb(std::move(completionCb)),
       m_momanCb(std::move(momanCb)), m_moman(moman),
       m_connection(std::move(connection)) {
 };
@@ -20,29 +25,29 @@ MonitorScraperCompletion::~MonitorScraperCompletion() {}
 
 void MonitorScraperCompletion::run() {
     auto shared = shared_from_this();
-    post(m_io, [=] {
+    post(m_strand, [=] {
         return shared->m_momanCb(
-            shared->m_moman, MonitorOrScraper::Monitor, shared->m_cmd,
+            shared->m_moman, MonitorOrScraper::Monitor,
             std::bind(&MonitorScraperCompletion::checkForCompletion, shared,
                       ph::_1),
             m_connection);
     });
-    post(m_io, [=] {
+    post(m_strand, [=] {
         return shared->m_momanCb(
-            shared->m_moman, MonitorOrScraper::Scraper, shared->m_cmd,
+            shared->m_moman, MonitorOrScraper::Scraper,
             std::bind(&MonitorScraperCompletion::checkForCompletion, shared,
                       ph::_1),
             m_connection);
     });
 };
 
-void MonitorScraperCompletion::create(io_context &io, MonitorManager *moman,
-                                      const Cmd &cmd,
+void MonitorScraperCompletion::create(const Strand &strand,
+                                      MonitorManager *moman,
                                       MonitorManagerCallback &&momanCb,
                                       DoubleResponseCallback &&completionCb,
                                       Connection::Ptr connection) {
     std::make_shared<MonitorScraperCompletion>(
-        io, moman, cmd, std::move(momanCb), std::move(completionCb),
+        strand, moman, std::move(momanCb), std::move(completionCb),
         std::move(connection))
         ->run();
 }
@@ -56,13 +61,84 @@ void MonitorScraperCompletion::checkForCompletion(const Response &response) {
     m_completionCb(m_firstResponse, response);
 }
 
+BatchCompletion::BatchCompletion(const Strand &strand,
+                                 std::vector<std::string> names,
+                                 size_t maxInFlight, Operation &&operation,
+                                 CompletionCallback &&completionCb)
+    : m_strand(strand), m_names(std::move(names)),
+      m_maxInFlight(std::max<size_t>(1, maxInFlight)),
+      m_operation(std::move(operation)),
+      m_completionCb(std::move(completionCb)), m_responses(m_names.size()) {}
+
+void BatchCompletion::create(const Strand &strand,
+                             std::vector<std::string> names,
+                             size_t maxInFlight, Operation &&operation,
+                             CompletionCallback &&completionCb) {
+    auto batch = std::make_shared<BatchCompletion>(
+        strand, std::move(names), maxInFlight, std::move(operation),
+        std::move(completionCb));
+    if (batch->m_names.empty())
+        batch->m_completionCb(batch->m_names, batch->m_responses);
+    else
+        batch->startNext();
+}
+
+void BatchCompletion::startNext() {
+    auto shared = shared_from_this();
+    for (; m_inFlight < m_maxInFlight && m_next < m_names.size(); m_next++) {
+        m_inFlight++;
+        const size_t index = m_next;
+        // the operation may complete synchronously: don't re-enter this loop
+        post(m_strand, [shared, this, index] {
+            m_operation(m_names[index], std::bind(&BatchCompletion::onDone,
+                                                  shared, index, ph::_1));
+        });
+    }
+}
+
+void BatchCompletion::onDone(size_t index, const Response &response) {
+    m_responses[index] = response;
+    m_inFlight--;
+    if (++m_completed == m_names.size())
+        m_completionCb(m_names, m_responses);
+    else
+        startNext();
+}
+
+// the names of a batch command, without duplicates nor empty ones
+static bool getBatchNames(const NamesPayload &payload,
+                          std::vector<std::string> &names,
+                          Response &response) {
+    std::unordered_set<std::string> seen;
+    for (const auto &name : payload.p_names)
+        if (!name.empty() && seen.insert(name).second)
+            names.push_back(name);
+    if (names.empty()) {
+        response.setError(ERRORS::BAD_PAYLOAD);
+        response.setInfo("\"names\" is empty.");
+        return false;
+    }
+    return true;
+}
+
 void MonitorManager::shutdown(const Cmd &cmd, const UserResponseCallback &&cb,
                               Connection::Ptr connection) {
     m_logger->info("Shutting down...");
     m_fileWatcher.inotify.Close();
     m_unixServer.shutdown();
-    terminateProcesses(_storedMonitors);
-    terminateProcesses(_storedScrapers);
+    m_registry.stop();
+    if (m_zygote)
+        m_zygote->stop();
+    m_channels.closeAll();
+    for (auto &reload : m_configReloads)
+        reload.second->cancel();
+    m_configReloads.clear();
+    m_metricsTimer.cancel();
+    {
+        std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+        terminateProcesses(_storedMonitors);
+        terminateProcesses(_storedScrapers);
+    }
     cb(Response::okResponse(), connection);
 }
 
@@ -74,7 +150,8 @@ void MonitorManager::onPing(const Cmd &cmd, const UserResponseCallback &&cb,
     cb(response, connection);
 }
 
-void MonitorManager::onAdd(const MonitorOrScraper m, const Cmd &cmd,
+void MonitorManager::onAdd(const MonitorOrScraper m,
+                           const NamePayload &payload,
                            const UserResponseCallback &&cb,
                            Connection::Ptr connection) {
     Response response;
@@ -82,198 +159,273 @@ void MonitorManager::onAdd(const MonitorOrScraper m, const Cmd &cmd,
                               ? ERRORS::MM_COULDNT_ADD_MONITOR
                               : ERRORS::MM_COULDNT_ADD_SCRAPER;
 
-    if (cmd.payload() == nullptr) {
-        response.setError(ERRORS::MISSING_PAYLOAD);
+    const std::string &className = payload.p_name;
+
+    if (!checkCanBeAdded(m, className, response)) {
         cb(response, connection);
         return;
     }
 
-    std::string className;
-    const json &payload = cmd.payload();
+    if (!m_stubMonitor.empty()) {
+        spawn(m, className, m_stubMonitor, cb, connection);
+        return;
+    }
 
-    if (payload.find("name") != payload.end()) {
-        className = payload.at("name");
-    } else {
-        response.setError(ERRORS::MISSING_PAYLOAD_ARGS);
-        response.setInfo("Missing payload arg: \"name\".");
+    if (utils::getPythonExecutable().empty()) {
+        response.setError(genericError);
+        response.setInfo("Could not find a correct python version.");
         cb(response, connection);
         return;
     }
 
-    auto &storedObjects =
-        m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
-
-    auto it = storedObjects.find(className);
-    if (it != storedObjects.end()) {
-        if (it->second.p_isBeingAdded) {
+    m_registry.asyncLookup(m, className, [=](const std::optional<std::string>
+                                                 &path,
+                                             const std::string &error) {
+        Response response;
+        if (!error.empty()) {
             response.setError(genericError);
             response.setInfo(
-                std::string{
-                    (m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper")} +
-                " still being processed.");
+                "Failed to query the database (is it up and running?)\n" +
+                error);
             cb(response, connection);
             return;
         }
-        if (it->second.p_process) {
-            response.setError(genericError);
-            response.setInfo(
-                std::string{
-                    (m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper")} +
-                " already started.");
+        if (!path) {
+            m_logger->debug(
+                "Tried to add {} {} but it was not registered",
+                m == MonitorOrScraper::Monitor ? "monitor" : "scraper",
+                className);
+            response.setError(m == MonitorOrScraper::Monitor
+                                  ? ERRORS::MONITOR_NOT_REGISTERED
+                                  : ERRORS::SCRAPER_NOT_REGISTERED);
             cb(response, connection);
             return;
         }
-        if (it->second.p_endpoint) {
-            response.setError(genericError);
-            response.setInfo(
-                std::string{
-                    (m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper")} +
-                " already has a socket available.");
+        // another add might have gone through while looking the path up
+        if (!checkCanBeAdded(m, className, response)) {
             cb(response, connection);
             return;
         }
-    }
+        spawn(m, className, *path, cb, connection);
+    });
+}
 
-    const auto pythonExecutable = utils::getPythonExecutable().generic_string();
-    if (pythonExecutable.empty()) {
+bool MonitorManager::checkCanBeAdded(MonitorOrScraper m,
+                                     const std::string &className,
+                                     Response &response) {
+    const ERRORS genericError = m == MonitorOrScraper::Monitor
+                                    ? ERRORS::MM_COULDNT_ADD_MONITOR
+                                    : ERRORS::MM_COULDNT_ADD_SCRAPER;
+    auto &storedObjects =
+        m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
+
+    auto it = storedObjects.find(className);
+    if (it == storedObjects.end())
+        return true;
+    if (it->second.p_isBeingAdded) {
         response.setError(genericError);
-        response.setInfo("Could not find a correct python version.");
-        cb(response, connection);
+        response.setInfo(
+            std::string{
+                (m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper")} +
+            " still being processed.");
+        return false;
+    }
+    if (it->second.p_process) {
+        response.setError(genericError);
+        response.setInfo(
+            std::string{
+                (m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper")} +
+            " already started.");
+        return false;
+    }
+    if (it->second.p_endpoint) {
+        response.setError(genericError);
+        response.setInfo(
+            std::string{
+                (m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper")} +
+            " already has a socket available.");
+        return false;
+    }
+    return true;
+}
+
+void MonitorManager::spawn(MonitorOrScraper m, const std::string &className,
+                           const std::string &scriptPath,
+                           const UserResponseCallback &cb,
+                           Connection::Ptr connection) {
+    const auto argv =
+        m_stubMonitor.empty()
+            ? std::vector<std::string>{scriptPath, "--no-config-watcher",
+                                       "--no-output"}
+            : std::vector<std::string>{
+                  (m == MonitorOrScraper::Monitor ? "Monitor." : "Scraper.") +
+                  className};
+    const auto spawnedAt = std::chrono::steady_clock::now();
+    // the zygote can only run python scripts
+    if (!m_zygote || !m_stubMonitor.empty()) {
+        std::error_code ec;
+        auto process = startProcess(m, className, argv, ec);
+        onSpawned(m, className, std::move(process), ec, spawnedAt, cb,
+                  connection);
         return;
     }
 
-    auto &registerDb = m == MonitorOrScraper::Monitor ? m_monitorRegisterDb
-                                                      : m_scraperRegisterDb;
+    // keep other adds out while the zygote forks. The script may answer on
+    // its socket before the pid is read: the timer is there to be cancelled,
+    // and armed by onSpawned
+    auto &storedObjects =
+        m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
+    auto it = storedObjects.find(className);
+    if (it == storedObjects.end()) {
+        std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+        it = storedObjects.emplace(className, StoredObject{className}).first;
+    }
+    it->second.p_onAddTimer = std::make_shared<steady_timer>(m_io);
+    it->second.p_confirmAdded = false;
+    it->second.p_isBeingAdded = true;
+    m_zygote->asyncFork(argv, [=](pid_t pid, const std::string &error) {
+        std::error_code ec;
+        Process::Ptr process;
+        if (pid != -1)
+            process = Process::adopt(
+                m_io, m_strand, className, pid,
+                std::bind(&MonitorManager::onProcessExit, this, ph::_1,
+                          ph::_2, m, className));
+        else {
+            m_logger->warn("The zygote couldn't fork {}: {} Starting a new "
+                           "interpreter instead",
+                           className, error);
+            process = startProcess(m, className, argv, ec);
+        }
+        onSpawned(m, className, std::move(process), ec, spawnedAt, cb,
+                  connection);
+    });
+}
+
+Process::Ptr MonitorManager::startProcess(MonitorOrScraper m,
+                                          const std::string &className,
+                                          const std::vector<std::string> &argv,
+                                          std::error_code &ec) {
+    // absolute interpreter and ready made argv: no shell-style parsing nor
+    // PATH lookup. The exit callback already runs on m_strand
+    return Process::create(m_io, m_strand, className,
+                           m_stubMonitor.empty()
+                               ? utils::getPythonExecutable().string()
+                               : m_stubMonitor,
+                           argv,
+                           std::bind(&MonitorManager::onProcessExit, this,
+                                     ph::_1, ph::_2, m, className),
+                           ec);
+}
+
+void MonitorManager::onSpawned(MonitorOrScraper m, const std::string &className,
+                               Process::Ptr process, const std::error_code &ec,
+                               std::chrono::steady_clock::time_point spawnedAt,
+                               const UserResponseCallback &cb,
+                               Connection::Ptr connection) {
+    const ERRORS genericError = m == MonitorOrScraper::Monitor
+                                    ? ERRORS::MM_COULDNT_ADD_MONITOR
+                                    : ERRORS::MM_COULDNT_ADD_SCRAPER;
+    auto &storedObjects =
+        m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
+    auto it = storedObjects.find(className);
 
-    bsoncxx::stdx::optional<bsoncxx::document::value> optRegisteredMonitor;
-    try {
-        optRegisteredMonitor =
-            registerDb.find_one(bsoncxx::builder::basic::make_document(
-                bsoncxx::builder::basic::kvp("name", className)));
-    } catch (const mongocxx::query_exception &e) {
+    if (!process) {
+        if (it != storedObjects.end()) {
+            it->second.p_isBeingAdded = false;
+            if (!it->second.p_endpoint) {
+                std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+                storedObjects.erase(it);
+            }
+        }
+        Response response = Response::badResponse();
         response.setError(genericError);
-        response.setInfo(
-            "Failed to query the database (is it up and running?)\n" +
-            std::string{e.what()});
+        response.setInfo("Failed to start process: " + ec.message());
         cb(response, connection);
         return;
     }
 
-    if (!optRegisteredMonitor) {
-        m_logger->debug("Tried to add {} {} but it was not registered",
-                       m == MonitorOrScraper::Monitor ? "monitor" : "scraper",
-                       className);
-        response.setError(m == MonitorOrScraper::Monitor
-                              ? ERRORS::MONITOR_NOT_REGISTERED
-                              : ERRORS::SCRAPER_NOT_REGISTERED);
-        cb(response, connection);
+    std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+    if (it == storedObjects.end())
+        it = storedObjects.emplace(className, StoredObject{className}).first;
+    StoredObject &obj = it->second;
+    obj.p_process = std::move(process);
+    lock.unlock();
+    if (obj.p_isBeingAdded && obj.p_confirmAdded) {
+        // answered on its socket while the zygote was forking
+        obj.p_isBeingAdded = false;
+        obj.p_confirmAdded = false;
+        m_metrics.spawnReady(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - spawnedAt));
+        cb(Response::okResponse(), connection);
         return;
     }
-
-    // insanity at its best!
-    const auto path = std::string{
-        optRegisteredMonitor.value().view()["path"].get_utf8().value};
-    auto delayTimer =
-        std::make_shared<steady_timer>(m_io, std::chrono::seconds(2));
-    auto &&onExitCb = std::bind(&MonitorManager::onProcessExit, this, ph::_1,
-                                ph::_2, m, className);
-
-    if (it != storedObjects.end()) {
-        StoredObject &obj = it->second;
-        obj.p_process = std::make_unique<Process>(
-            className, pythonExecutable + " " + path + " --no-config-watcher --no-output",
-            boost::process::std_out > boost::process::null,
-            boost::process::std_err > boost::process::null, m_io,
-            boost::process::on_exit(onExitCb));
-        obj.p_isBeingAdded = true;
-        obj.p_onAddTimer = delayTimer;
-    } else {
-        StoredObject obj{className};
-        obj.p_process = std::make_unique<Process>(
-            className, pythonExecutable + " " + path + " --no-config-watcher --no-output",
-            boost::process::std_out > boost::process::null,
-            boost::process::std_err > boost::process::null, m_io,
-            boost::process::on_exit(onExitCb));
-        obj.p_isBeingAdded = true;
-        obj.p_onAddTimer = delayTimer;
-        storedObjects.emplace(std::make_pair(className, std::move(obj)));
+    // the one made by spawn, if any
+    if (!obj.p_isBeingAdded || !obj.p_onAddTimer) {
+        obj.p_onAddTimer = std::make_shared<steady_timer>(m_io);
+        obj.p_confirmAdded = false;
     }
+    const auto addTimer = obj.p_onAddTimer;
+    addTimer->expires_after(m_addTimeout);
+    obj.p_isBeingAdded = true;
 
-    delayTimer->async_wait([=](const error_code &ec) {
+    addTimer->async_wait(bind_executor(m_strand, [=](const error_code &ec) {
         /*
 onAdd possible outcomes:
- 1) NO OUTCOME: MonitorManager destructor => timer.cancel() --> return;
- 2) FAIL: process exits sooner than timer => onProcessExit --> timer.cancel(),
-    process removed, server/connection callback -> in async_wait: check for
-iterator
- 3) OK: process does not exit sooner, socket gets created => onSocketUpdate =>
-    timer.cancel(), confirmAdded = true -> in async_wait: check for confirmAdded
- 4) OK: process does not exit sooner, socket not created => async_wait
+ 1) NO OUTCOME: shutdown => timer.cancel() while the process is still there
+    --> return;
+ 2) FAIL: process exits before being ready => onProcessExit => timer.cancel(),
+    process removed
+ 3) OK: socket gets created and answers PING => checkSocketAndUpdateList =>
+    confirmAdded = true, timer.cancel()
+ 4) FAIL: none of the above within m_addTimeout. The process is left running
+    and is still picked up if its socket shows up later.
         */
-
-        if (ec) {
-            if (ec == boost::system::errc::operation_canceled) {
-                auto &map = m == MonitorOrScraper::Monitor ? _storedMonitors
-                                                           : _storedScrapers;
-                auto it = map.find(className);
-                if (it == map.end()) // className not found => 2)
-                {
-                    Response response = Response::badResponse();
-                    response.setError(genericError);
-                    response.setInfo("Process exited sooner than expected.");
-                    cb(response, connection);
-                    return;
-                } else // className found
-                {
-                    StoredObject &storedObject = it->second;
-                    storedObject.p_isBeingAdded = false;
-                    if (storedObject.p_confirmAdded) // => 3)
-                    {
-                        storedObject.p_confirmAdded = false;
-                        cb(Response::okResponse(), connection);
-                        return;
-                    }
-                }
-
-                // everything else is 1)
-            }
-        } else {
-            auto &map = m == MonitorOrScraper::Monitor ? _storedMonitors
-                                                       : _storedScrapers;
-            auto it = map.find(className);
-            if (it == map.end()) {
-                Response response = Response::badResponse();
-                response.setError(genericError);
-                response.setInfo(
-                    "Process exited sooner than expected. (WARNING: THIS CASE "
-                    "(1) SHOULD NOT HAVE HAPPENED -- NEED TO DEBUG!!!)");
-                cb(response, connection);
-                return;
-            } else {
-                auto &storedObject = it->second;
-                if (storedObject.p_process->process().running()) {
-                    storedObject.p_isBeingAdded = false;
-                    cb(Response::okResponse(), connection);
-                    return;
-                } else {
-                    Response response = Response::badResponse();
-                    response.setError(genericError);
-                    response.setInfo("Process exited sooner than expected. "
-                                     "(WARNING: THIS CASE (2) SHOULD NOT HAVE "
-                                     "HAPPENED -- NEED TO DEBUG!!!)");
-                    cb(response, connection);
-                    return;
-                }
-            }
+        auto &map =
+            m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
+        auto it = map.find(className);
+        if (it == map.end() || !it->second.p_process) { // => 2)
+            if (it != map.end())
+                it->second.p_isBeingAdded = false;
+            Response response = Response::badResponse();
+            response.setError(genericError);
+            response.setInfo("Process exited sooner than expected.");
+            cb(response, connection);
+            return;
         }
-    });
+        StoredObject &storedObject = it->second;
+        if (storedObject.p_confirmAdded) { // => 3)
+            storedObject.p_isBeingAdded = false;
+            storedObject.p_confirmAdded = false;
+            m_metrics.spawnReady(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - spawnedAt));
+            cb(Response::okResponse(), connection);
+            return;
+        }
+        if (ec) // => 1)
+            return;
+        // => 4)
+        storedObject.p_isBeingAdded = false;
+        Response response = Response::badResponse();
+        response.setError(genericError);
+        response.setInfo(fmt::format(
+            "Process is running but did not answer on its socket within {} ms.",
+            m_addTimeout.count()));
+        cb(response, connection);
+    }));
 }
 
-void MonitorManager::onAddMonitorScraper(const Cmd &cmd,
+void MonitorManager::onAddMonitorScraper(const NamePayload &payload,
                                          const UserResponseCallback &&cb,
                                          Connection::Ptr connection) {
     MonitorScraperCompletion::create(
-        m_io, this, cmd, &MonitorManager::onAdd,
+        m_strand, this,
+        [payload](MonitorManager *moman, MonitorOrScraper m,
+                  const UserResponseCallback &&cb, Connection::Ptr connection) {
+            moman->onAdd(m, payload, std::move(cb), std::move(connection));
+        },
         [=](const Response &firstResponse, const Response &secondResponse) {
             cb(utils::makeCommonResponse(
                    firstResponse, secondResponse,
@@ -283,16 +435,13 @@ void MonitorManager::onAddMonitorScraper(const Cmd &cmd,
         connection);
 }
 
-void MonitorManager::onGetStatus(const MonitorOrScraper m, const Cmd &cmd,
-                                 const UserResponseCallback &&cb,
-                                 Connection::Ptr connection) {
-    Response response;
+json MonitorManager::statusPayload(
+    const std::unordered_map<std::string, StoredObject> &storedObjects) {
     json payload;
     json monitoredProcesses = json::object();
     json monitoredSockets = json::object();
 
-    for (const auto &it :
-         m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers) {
+    for (const auto &it : storedObjects) {
         const auto &storedObject = it.second;
         if (storedObject.p_process) {
             monitoredProcesses[storedObject.p_className] =
@@ -305,33 +454,63 @@ void MonitorManager::onGetStatus(const MonitorOrScraper m, const Cmd &cmd,
     }
     payload["monitored_processes"] = monitoredProcesses;
     payload["monitored_sockets"] = monitoredSockets;
+    return payload;
+}
 
-    response.setPayload(payload);
+void MonitorManager::onGetStatus(const MonitorOrScraper m, const Cmd &cmd,
+                                 const UserResponseCallback &&cb,
+                                 Connection::Ptr connection) {
+    // not on m_strand, see s_concurrentCmdHandlers
+    Response response;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+        response.setPayload(statusPayload(m == MonitorOrScraper::Monitor
+                                              ? _storedMonitors
+                                              : _storedScrapers));
+    }
     cb(response, connection);
 }
 
 void MonitorManager::onGetMonitorScraperStatus(const Cmd &cmd,
                                                const UserResponseCallback &&cb,
                                                Connection::Ptr connection) {
-    MonitorScraperCompletion::create(
-        m_io, this, cmd, &MonitorManager::onGetStatus,
-        [=](const Response &firstResponse, const Response &secondResponse) {
-            Response response{
-                utils::makeCommonResponse(firstResponse, secondResponse)};
-            json payload;
-            json tmpPayload = firstResponse.payload();
-            payload["monitors"] =
-                tmpPayload.is_null() ? json::object() : tmpPayload;
-            tmpPayload = secondResponse.payload();
-            payload["scrapers"] =
-                tmpPayload.is_null() ? json::object() : tmpPayload;
-            response.setPayload(payload);
-            cb(response, connection);
-        },
-        connection);
+    // both read under the same lock instead of going through
+    // MonitorScraperCompletion, which runs on m_strand
+    Response response = Response::okResponse();
+    json payload;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+        payload["monitors"] = statusPayload(_storedMonitors);
+        payload["scrapers"] = statusPayload(_storedScrapers);
+    }
+    response.setPayload(payload);
+    cb(response, connection);
+}
+
+void MonitorManager::onGetConfigPushes(const ConfigPushesPayload &payload,
+                                       const UserResponseCallback &&cb,
+                                       Connection::Ptr connection) {
+    // the "last" most recent reports, all of them by default
+    const size_t last =
+        std::min(m_pushReports.size(),
+                 payload.p_last.value_or(m_pushReports.size()));
+    json reports = json::array();
+    std::copy(m_pushReports.end() - last, m_pushReports.end(),
+              std::back_inserter(reports));
+    Response response;
+    response.setPayload(json{{"reports", std::move(reports)}});
+    cb(response, connection);
+}
+
+void MonitorManager::onGetMetrics(const Cmd &cmd,
+                                  const UserResponseCallback &&cb,
+                                  Connection::Ptr connection) {
+    Response response;
+    response.setPayload(m_metrics.toJson(metricsGauges()));
+    cb(response, connection);
 }
 
-void MonitorManager::onStop(MonitorOrScraper m, const Cmd &cmd,
+void MonitorManager::onStop(MonitorOrScraper m, const NamePayload &payload,
                             const kekmonitors::UserResponseCallback &&cb,
                             Connection::Ptr connection) {
     ERRORS genericError = m == MonitorOrScraper::Monitor
@@ -339,23 +518,7 @@ void MonitorManager::onStop(MonitorOrScraper m, const Cmd &cmd,
                               : ERRORS::MM_COULDNT_STOP_SCRAPER;
     Response response;
 
-    if (cmd.payload() == nullptr) {
-        response.setError(ERRORS::MISSING_PAYLOAD);
-        cb(response, connection);
-        return;
-    }
-
-    std::string className;
-    const json &payload = cmd.payload();
-
-    if (payload.find("name") != payload.end()) {
-        className = payload.at("name");
-    } else {
-        response.setError(ERRORS::MISSING_PAYLOAD_ARGS);
-        response.setInfo("Missing payload arg: \"name\".");
-        cb(response, connection);
-        return;
-    }
+    const std::string &className = payload.p_name;
 
     auto &storedObjects =
         m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
@@ -384,47 +547,45 @@ void MonitorManager::onStop(MonitorOrScraper m, const Cmd &cmd,
     }
 
     storedObject.p_isBeingStopped = true;
-    auto &ep = storedObject.p_endpoint;
-    auto newConn = Connection::create(m_io);
-    newConn->p_endpoint.connect(*ep);
+    const auto endpoint = *storedObject.p_endpoint;
     Cmd newCmd;
     newCmd.setCmd(COMMANDS::STOP);
-    newConn->asyncWriteCmd(newCmd, [=](const error_code &errc,
-                                       Connection::Ptr conn) {
-        auto &storedObjects =
-            m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
-        auto it = storedObjects.find(className);
-        if (it != storedObjects.end()) {
-            removeStoredSocket(storedObjects, it);
-        }
-        if (!errc) {
-            KDBG("Sent STOP correctly");
-            conn->asyncReadResponse([=](const error_code &errc,
-                                        const Response &response,
-                                        Connection::Ptr conn) {
-                if (errc && errc != error::operation_aborted)
-                    m_logger->error("Error while waiting for stop response: {}", errc.message());
-                else
-                    m_logger->debug("Successfully stopped {}", className);
-                cb(response, conn);
-            });
-        } else {
-            if (errc != error::operation_aborted)
-                m_logger->error(errc.message());
-            Response response;
-            response.setError(genericError);
-            response.setInfo("Failed to send the STOP command: " +
-                             errc.message());
-            cb(response, conn);
-        }
-    });
+    m_channels.get(endpoint)->asyncSendCmd(
+        newCmd, [=](const error_code &errc, const Response &stopResponse) {
+            auto &storedObjects = m == MonitorOrScraper::Monitor
+                                      ? _storedMonitors
+                                      : _storedScrapers;
+            auto it = storedObjects.find(className);
+            if (it != storedObjects.end()) {
+                std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+                removeStoredSocket(storedObjects, it);
+            }
+            m_channels.remove(endpoint);
+            if (!errc) {
+                m_logger->debug("Successfully stopped {}", className);
+                cb(stopResponse, connection);
+            } else {
+                if (errc != error::operation_aborted)
+                    m_logger->error("Error while sending STOP: {}",
+                                    errc.message());
+                Response response;
+                response.setError(genericError);
+                response.setInfo("Failed to send the STOP command: " +
+                                 errc.message());
+                cb(response, connection);
+            }
+        });
 }
 
-void MonitorManager::onStopMonitorScraper(const Cmd &cmd,
+void MonitorManager::onStopMonitorScraper(const NamePayload &payload,
                                           const UserResponseCallback &&cb,
                                           Connection::Ptr connection) {
     MonitorScraperCompletion::create(
-        m_io, this, cmd, &MonitorManager::onStop,
+        m_strand, this,
+        [payload](MonitorManager *moman, MonitorOrScraper m,
+                  const UserResponseCallback &&cb, Connection::Ptr connection) {
+            moman->onStop(m, payload, std::move(cb), std::move(connection));
+        },
         [=](const Response &firstResponse, const Response &secondResponse) {
             cb(utils::makeCommonResponse(
                    firstResponse, secondResponse,
@@ -433,4 +594,108 @@ void MonitorManager::onStopMonitorScraper(const Cmd &cmd,
         },
         connection);
 }
-} // namespace kekmonitors
\ No newline at end of file
+
+void MonitorManager::onAddMany(const MonitorOrScraper m,
+                               const NamesPayload &payload,
+                               const UserResponseCallback &&cb,
+                               Connection::Ptr connection) {
+    const ERRORS genericError = m == MonitorOrScraper::Monitor
+                                    ? ERRORS::MM_COULDNT_ADD_MONITOR
+                                    : ERRORS::MM_COULDNT_ADD_SCRAPER;
+    Response response;
+    std::vector<std::string> names;
+    if (!getBatchNames(payload, names, response)) {
+        cb(response, connection);
+        return;
+    }
+
+    const auto addAll = [=](const Registry::PathMap &paths,
+                            const std::string &error) {
+        if (!error.empty()) {
+            Response response;
+            response.setError(genericError);
+            response.setInfo(
+                "Failed to query the database (is it up and running?)\n" +
+                error);
+            cb(response, connection);
+            return;
+        }
+        BatchCompletion::create(
+            m_strand, names, m_batchConcurrency,
+            [=](const std::string &className,
+                BatchCompletion::DoneCallback &&done) {
+                Response response;
+                const auto path = paths.find(className);
+                if (path == paths.end()) {
+                    response.setError(m == MonitorOrScraper::Monitor
+                                          ? ERRORS::MONITOR_NOT_REGISTERED
+                                          : ERRORS::SCRAPER_NOT_REGISTERED);
+                    done(response);
+                    return;
+                }
+                if (!checkCanBeAdded(m, className, response)) {
+                    done(response);
+                    return;
+                }
+                spawn(m, className, path->second,
+                      [done](const Response &response, Connection::Ptr) {
+                          done(response);
+                      },
+                      connection);
+            },
+            [=](const std::vector<std::string> &names,
+                const std::vector<Response> &responses) {
+                cb(utils::makeBatchResponse(names, responses, genericError),
+                   connection);
+            });
+    };
+
+    if (!m_stubMonitor.empty()) {
+        Registry::PathMap paths;
+        for (const auto &className : names)
+            paths.emplace(className, m_stubMonitor);
+        addAll(paths, "");
+        return;
+    }
+
+    if (utils::getPythonExecutable().empty()) {
+        response.setError(genericError);
+        response.setInfo("Could not find a correct python version.");
+        cb(response, connection);
+        return;
+    }
+
+    m_registry.asyncLookupMany(m, names, addAll);
+}
+
+void MonitorManager::onStopMany(const MonitorOrScraper m,
+                                const NamesPayload &payload,
+                                const UserResponseCallback &&cb,
+                                Connection::Ptr connection) {
+    const ERRORS genericError = m == MonitorOrScraper::Monitor
+                                    ? ERRORS::MM_COULDNT_STOP_MONITOR
+                                    : ERRORS::MM_COULDNT_STOP_SCRAPER;
+    Response response;
+    std::vector<std::string> names;
+    if (!getBatchNames(payload, names, response)) {
+        cb(response, connection);
+        return;
+    }
+
+    BatchCompletion::create(
+        m_strand, std::move(names), m_batchConcurrency,
+        [=](const std::string &className,
+            BatchCompletion::DoneCallback &&done) {
+            onStop(m, NamePayload{className},
+                   [done](const Response &response, Connection::Ptr) {
+                       done(response);
+                   },
+                   connection);
+        },
+        [=](const std::vector<std::string> &names,
+            const std::vector<Response> &responses) {
+            cb(utils::makeBatchResponse(names, responses, genericError),
+               connection);
+        });
+}
+} // namespace kekmonitors
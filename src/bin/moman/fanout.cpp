@@ -0,0 +1,160 @@
+#include "fanout.hpp"
+#include <algorithm>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+
+namespace kekmonitors {
+
+static const char *outcomeToString(FanOut::Outcome outcome) {
+    switch (outcome) {
+    case FanOut::Outcome::Delivered:
+        return "delivered";
+    case FanOut::Outcome::Failed:
+        return "failed";
+    case FanOut::Outcome::TimedOut:
+        return "timed_out";
+    default:
+        return "pending";
+    }
+}
+
+static double toMs(const std::chrono::microseconds &duration) {
+    return duration.count() / 1000.0;
+}
+
+size_t FanOut::Report::count(Outcome outcome) const {
+    return std::count_if(
+        p_results.begin(), p_results.end(),
+        [outcome](const Result &result) { return result.p_outcome == outcome; });
+}
+
+json FanOut::Report::toJson() const {
+    json targets = json::array();
+    std::chrono::microseconds total{0}, max{0};
+    for (size_t i = 0; i < p_targets.size(); i++) {
+        const auto &result = p_results[i];
+        json target{
+            {"name", p_targets[i].p_className},
+            {"type", p_targets[i].p_type == MonitorOrScraper::Monitor
+                         ? "monitor"
+                         : "scraper"},
+            {"outcome", outcomeToString(result.p_outcome)},
+            {"latency_ms", toMs(result.p_latency)}};
+        if (!result.p_error.empty())
+            target["error"] = result.p_error;
+        targets.push_back(std::move(target));
+        if (result.p_outcome == Outcome::Delivered) {
+            total += result.p_latency;
+            max = std::max(max, result.p_latency);
+        }
+    }
+    const size_t delivered = count(Outcome::Delivered);
+    return {{"id", p_id},
+            {"description", p_description},
+            {"started_at", p_startedAt},
+            {"duration_ms", toMs(p_duration)},
+            {"delivered", delivered},
+            {"failed", count(Outcome::Failed)},
+            {"timed_out", count(Outcome::TimedOut)},
+            // of the delivered ones
+            {"avg_latency_ms", delivered ? toMs(total) / delivered : 0.0},
+            {"max_latency_ms", toMs(max)},
+            {"targets", std::move(targets)}};
+}
+
+FanOut::FanOut(io_context &io, const Strand &strand, ChannelPool &channels,
+               std::vector<Target> targets, size_t maxInFlight,
+               const steady_timer::duration &deadline, uint64_t id,
+               std::string description, CompletionCallback &&completionCb)
+    : m_io(io), m_strand(strand), m_channels(channels),
+      m_maxInFlight(std::max<size_t>(1, maxInFlight)), m_deadline(deadline),
+      m_completionCb(std::move(completionCb)),
+      m_start(std::chrono::steady_clock::now()) {
+    m_report.p_id = id;
+    m_report.p_description = std::move(description);
+    m_report.p_startedAt = std::time(nullptr);
+    m_report.p_targets = std::move(targets);
+    m_report.p_results.resize(m_report.p_targets.size());
+    m_sentAt.resize(m_report.p_targets.size());
+    m_timers.resize(m_report.p_targets.size());
+}
+
+void FanOut::create(io_context &io, const Strand &strand,
+                    ChannelPool &channels, std::vector<Target> targets,
+                    size_t maxInFlight,
+                    const steady_timer::duration &deadline, uint64_t id,
+                    std::string description,
+                    CompletionCallback &&completionCb) {
+    auto fanOut = std::make_shared<FanOut>(
+        io, strand, channels, std::move(targets), maxInFlight, deadline, id,
+        std::move(description), std::move(completionCb));
+    if (fanOut->m_report.p_targets.empty())
+        fanOut->m_completionCb(fanOut->m_report);
+    else
+        fanOut->startNext();
+}
+
+void FanOut::startNext() {
+    auto shared = shared_from_this();
+    for (; m_inFlight < m_maxInFlight && m_next < m_report.p_targets.size();
+         m_next++) {
+        m_inFlight++;
+        const size_t index = m_next;
+        // the channel may complete synchronously: don't re-enter this loop
+        post(m_strand, [shared, this, index] { send(index); });
+    }
+}
+
+void FanOut::send(size_t index) {
+    auto shared = shared_from_this();
+    m_sentAt[index] = std::chrono::steady_clock::now();
+    m_timers[index] = std::make_unique<steady_timer>(m_io, m_deadline);
+    m_timers[index]->async_wait(
+        bind_executor(m_strand, [shared, this, index](const error_code &err) {
+            if (!err)
+                onDone(index, Outcome::TimedOut, "");
+        }));
+    const auto &target = m_report.p_targets[index];
+    m_channels.get(target.p_endpoint)
+        ->asyncSendCmd(
+            target.p_cmd,
+            [shared, this, index](const error_code &err,
+                                  const Response &response) {
+                // the channel has the same deadline as m_timers, and may
+                // notice it first
+                if (err == error::timed_out)
+                    onDone(index, Outcome::TimedOut, "");
+                else if (err)
+                    onDone(index, Outcome::Failed, err.message());
+                else if (response.error())
+                    onDone(index, Outcome::Failed,
+                           response.info().empty()
+                               ? "error " + std::to_string(response.error())
+                               : response.info());
+                else
+                    onDone(index, Outcome::Delivered, "");
+            },
+            m_deadline);
+}
+
+void FanOut::onDone(size_t index, Outcome outcome, std::string error) {
+    auto &result = m_report.p_results[index];
+    // the deadline and the response raced: the first one wins
+    if (result.p_outcome != Outcome::Pending)
+        return;
+    result.p_outcome = outcome;
+    result.p_latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_sentAt[index]);
+    result.p_error = std::move(error);
+    m_timers[index]->cancel();
+    m_inFlight--;
+    if (++m_completed == m_report.p_targets.size()) {
+        m_report.p_duration =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - m_start);
+        m_completionCb(m_report);
+    } else
+        startNext();
+}
+} // namespace kekmonitors
@@ -0,0 +1,91 @@
+#pragma once
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <ctime>
+#include <kekmonitors/channel.hpp>
+#include <kekmonitors/core.hpp>
+#include <kekmonitors/msg.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace boost::asio;
+
+namespace kekmonitors {
+
+/*
+ * Sends a Cmd to each of many monitors/scrapers, with at most m_maxInFlight
+ * of them at the same time and a deadline for each one, then reports what
+ * happened to every target. A target that misses its deadline is counted as
+ * timed out and frees its slot right away, whatever its channel does later.
+ * Everything runs on m_strand.
+ */
+class FanOut : public std::enable_shared_from_this<FanOut> {
+  public:
+    struct Target {
+        MonitorOrScraper p_type;
+        std::string p_className;
+        local::stream_protocol::endpoint p_endpoint;
+        // targets getting the same cmd should share it, so that it's only
+        // encoded once
+        SharedCmd::Ptr p_cmd;
+    };
+
+    enum class Outcome { Pending = 0, Delivered, Failed, TimedOut };
+
+    struct Result {
+        Outcome p_outcome{Outcome::Pending};
+        // from the moment the cmd was handed to the channel
+        std::chrono::microseconds p_latency{0};
+        std::string p_error{};
+    };
+
+    struct Report {
+        uint64_t p_id{0};
+        std::string p_description{};
+        std::time_t p_startedAt{0};
+        std::chrono::microseconds p_duration{0};
+        std::vector<Target> p_targets{};
+        std::vector<Result> p_results{};
+
+        size_t count(Outcome outcome) const;
+        json toJson() const;
+    };
+
+    typedef std::function<void(const Report &)> CompletionCallback;
+
+  private:
+    io_context &m_io;
+    Strand m_strand;
+    ChannelPool &m_channels;
+    const size_t m_maxInFlight;
+    const steady_timer::duration m_deadline;
+    const CompletionCallback m_completionCb;
+    Report m_report;
+    std::chrono::steady_clock::time_point m_start;
+    std::vector<std::chrono::steady_clock::time_point> m_sentAt;
+    std::vector<std::unique_ptr<steady_timer>> m_timers;
+    size_t m_next{0};
+    size_t m_inFlight{0};
+    size_t m_completed{0};
+
+    void startNext();
+    void send(size_t index);
+    void onDone(size_t index, Outcome outcome, std::string error);
+
+  public:
+    FanOut(io_context &io, const Strand &strand, ChannelPool &channels,
+           std::vector<Target> targets, size_t maxInFlight,
+           const steady_timer::duration &deadline, uint64_t id,
+           std::string description, CompletionCallback &&completionCb);
+
+    static void create(io_context &io, const Strand &strand,
+                       ChannelPool &channels, std::vector<Target> targets,
+                       size_t maxInFlight,
+                       const steady_timer::duration &deadline, uint64_t id,
+                       std::string description,
+                       CompletionCallback &&completionCb);
+};
+} // namespace kekmonitors
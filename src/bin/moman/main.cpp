@@ -0,0 +1,28 @@
+#include "moman.hpp"
+#include <algorithm>
+#include <kekmonitors/config.hpp>
+#include <thread>
+#include <vector>
+
+int main() {
+    io_context io;
+    kekmonitors::init();
+    // 0 means one thread per core
+    unsigned int threads = kekmonitors::getConfig().p_parser.get<unsigned int>(
+        "GlobalConfig.moman_threads", 1);
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    {
+        kekmonitors::MonitorManager moman(io);
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned int i = 1; i < threads; i++)
+            pool.emplace_back([&io] { io.run(); });
+        io.run();
+        for (auto &thread : pool)
+            thread.join();
+    }
+    // flushes what's still queued by the async loggers, once nothing can log
+    spdlog::shutdown();
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "metrics.hpp"
+#include <spdlog/fmt/fmt.h>
+
+namespace kekmonitors {
+
+constexpr std::array<uint64_t, 16> Histogram::s_bounds;
+
+void Histogram::observe(const std::chrono::microseconds &duration) {
+    const uint64_t us = duration.count() > 0 ? duration.count() : 0;
+    size_t bucket = 0;
+    while (bucket < s_bounds.size() && us > s_bounds[bucket])
+        bucket++;
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_sumUs.fetch_add(us, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+json Histogram::toJson() const {
+    json buckets = json::array();
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < m_buckets.size(); i++) {
+        cumulative += m_buckets[i].load(std::memory_order_relaxed);
+        buckets.push_back(
+            {{"le_ms", i < s_bounds.size() ? json(s_bounds[i] / 1000.0)
+                                           : json("+Inf")},
+             {"count", cumulative}});
+    }
+    return {{"count", count()},
+            {"sum_ms", m_sumUs.load(std::memory_order_relaxed) / 1000.0},
+            {"buckets", std::move(buckets)}};
+}
+
+void Histogram::toPrometheus(std::string &out, const std::string &name,
+                             const std::string &labels) const {
+    const std::string separator = labels.empty() ? "" : ",";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < m_buckets.size(); i++) {
+        cumulative += m_buckets[i].load(std::memory_order_relaxed);
+        const auto le = i < s_bounds.size()
+                            ? fmt::format("{}", s_bounds[i] / 1e6)
+                            : std::string{"+Inf"};
+        out += fmt::format("{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels,
+                           separator, le, cumulative);
+    }
+    const auto braces = labels.empty() ? "" : "{" + labels + "}";
+    out += fmt::format("{}_sum{} {}\n", name, braces,
+                       m_sumUs.load(std::memory_order_relaxed) / 1e6);
+    out += fmt::format("{}_count{} {}\n", name, braces, count());
+}
+
+Metrics::Metrics() : m_start(std::chrono::steady_clock::now()) {}
+
+Metrics::CommandMetrics &Metrics::command(CommandType cmd) {
+    return m_commands[builtinCommandIndex(cmd)];
+}
+
+const Metrics::CommandMetrics &Metrics::command(CommandType cmd) const {
+    return m_commands[builtinCommandIndex(cmd)];
+}
+
+std::string Metrics::commandName(size_t index) {
+    if (index == KEKMONITORS_BUILTIN_COMMANDS)
+        return "CUSTOM";
+    const auto cmd = builtinCommand(index);
+    const auto &commandNames = commandStringMap().left;
+    const auto it = commandNames.find(cmd);
+    return it != commandNames.end() ? it->second : std::to_string(cmd);
+}
+
+void Metrics::commandStarted(CommandType cmd) {
+    command(cmd).p_inFlight.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::commandDone(CommandType cmd, ErrorType error,
+                          const std::chrono::microseconds &latency) {
+    auto &metrics = command(cmd);
+    metrics.p_inFlight.fetch_sub(1, std::memory_order_relaxed);
+    metrics.p_count.fetch_add(1, std::memory_order_relaxed);
+    if (error != ERRORS::OK)
+        metrics.p_errors.fetch_add(1, std::memory_order_relaxed);
+    metrics.p_latency.observe(latency);
+}
+
+void Metrics::spawnReady(const std::chrono::microseconds &duration) {
+    m_spawnToReady.observe(duration);
+}
+
+void Metrics::configPushed(const std::chrono::microseconds &duration) {
+    m_configPush.observe(duration);
+}
+
+void Metrics::inotifyEvents(uint64_t count) {
+    m_inotifyEvents.fetch_add(count, std::memory_order_relaxed);
+}
+
+json Metrics::toJson(const Gauges &gauges) const {
+    json commands = json::object();
+    int64_t inFlight = 0;
+    for (size_t i = 0; i < m_commands.size(); i++) {
+        const auto &metrics = m_commands[i];
+        const auto commandInFlight =
+            metrics.p_inFlight.load(std::memory_order_relaxed);
+        inFlight += commandInFlight;
+        // only the commands that were received at least once
+        if (!metrics.p_count.load(std::memory_order_relaxed) &&
+            !commandInFlight)
+            continue;
+        commands[commandName(i)] = {
+            {"count", metrics.p_count.load(std::memory_order_relaxed)},
+            {"errors", metrics.p_errors.load(std::memory_order_relaxed)},
+            {"in_flight", commandInFlight},
+            {"latency", metrics.p_latency.toJson()}};
+    }
+    json payload{
+        {"uptime_s", std::chrono::duration_cast<std::chrono::seconds>(
+                         std::chrono::steady_clock::now() - m_start)
+                         .count()},
+        {"commands", std::move(commands)},
+        {"commands_in_flight", inFlight},
+        {"spawn_to_ready", m_spawnToReady.toJson()},
+        {"config_push", m_configPush.toJson()},
+        {"inotify_events", m_inotifyEvents.load(std::memory_order_relaxed)}};
+    for (const auto &gauge : gauges)
+        payload[gauge.first] = gauge.second;
+    return payload;
+}
+
+std::string Metrics::toPrometheus(const Gauges &gauges) const {
+    std::string out;
+    out += "# TYPE kekmonitors_moman_uptime_seconds gauge\n";
+    out += fmt::format("kekmonitors_moman_uptime_seconds {}\n",
+                       std::chrono::duration_cast<std::chrono::seconds>(
+                           std::chrono::steady_clock::now() - m_start)
+                           .count());
+
+    out += "# TYPE kekmonitors_moman_commands_total counter\n";
+    for (size_t i = 0; i < m_commands.size(); i++)
+        if (const auto count =
+                m_commands[i].p_count.load(std::memory_order_relaxed))
+            out += fmt::format(
+                "kekmonitors_moman_commands_total{{command=\"{}\"}} {}\n",
+                commandName(i), count);
+    out += "# TYPE kekmonitors_moman_command_errors_total counter\n";
+    for (size_t i = 0; i < m_commands.size(); i++)
+        if (m_commands[i].p_count.load(std::memory_order_relaxed))
+            out += fmt::format(
+                "kekmonitors_moman_command_errors_total{{command=\"{}\"}} "
+                "{}\n",
+                commandName(i),
+                m_commands[i].p_errors.load(std::memory_order_relaxed));
+    out += "# TYPE kekmonitors_moman_commands_in_flight gauge\n";
+    for (size_t i = 0; i < m_commands.size(); i++)
+        if (const auto inFlight =
+                m_commands[i].p_inFlight.load(std::memory_order_relaxed))
+            out += fmt::format(
+                "kekmonitors_moman_commands_in_flight{{command=\"{}\"}} {}\n",
+                commandName(i), inFlight);
+    out += "# TYPE kekmonitors_moman_command_duration_seconds histogram\n";
+    for (size_t i = 0; i < m_commands.size(); i++)
+        if (m_commands[i].p_latency.count())
+            m_commands[i].p_latency.toPrometheus(
+                out, "kekmonitors_moman_command_duration_seconds",
+                fmt::format("command=\"{}\"", commandName(i)));
+
+    out += "# TYPE kekmonitors_moman_spawn_to_ready_seconds histogram\n";
+    m_spawnToReady.toPrometheus(out,
+                                "kekmonitors_moman_spawn_to_ready_seconds");
+    out += "# TYPE kekmonitors_moman_config_push_seconds histogram\n";
+    m_configPush.toPrometheus(out, "kekmonitors_moman_config_push_seconds");
+    out += "# TYPE kekmonitors_moman_inotify_events_total counter\n";
+    out += fmt::format("kekmonitors_moman_inotify_events_total {}\n",
+                       m_inotifyEvents.load(std::memory_order_relaxed));
+    for (const auto &gauge : gauges) {
+        out += fmt::format("# TYPE kekmonitors_moman_{} gauge\n", gauge.first);
+        out += fmt::format("kekmonitors_moman_{} {}\n", gauge.first,
+                           gauge.second);
+    }
+    return out;
+}
+} // namespace kekmonitors
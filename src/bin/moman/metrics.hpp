@@ -0,0 +1,88 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <kekmonitors/core.hpp>
+#include <kekmonitors/msg.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kekmonitors {
+
+/*
+ * Latencies in fixed buckets, like a prometheus histogram. Every method is
+ * thread safe: observations come from whatever thread completed the
+ * operation.
+ */
+class Histogram {
+  public:
+    // upper bounds in microseconds, the last bucket (+Inf) is implicit
+    static constexpr std::array<uint64_t, 16> s_bounds{
+        100,    250,    500,     1000,    2500,    5000,    10000,   25000,
+        50000,  100000, 250000,  500000,  1000000, 2500000, 5000000, 10000000};
+
+  private:
+    std::array<std::atomic<uint64_t>, s_bounds.size() + 1> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sumUs{0};
+
+  public:
+    void observe(const std::chrono::microseconds &duration);
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    // {"count", "sum_ms", "buckets": [{"le_ms", "count"}, ...]}, cumulative
+    // counts like prometheus
+    json toJson() const;
+    // name_bucket{labels,le="..."}, name_sum and name_count lines, in seconds
+    void toPrometheus(std::string &out, const std::string &name,
+                      const std::string &labels = "") const;
+};
+
+/*
+ * What MonitorManager spends its time on: per command counts, errors and
+ * latency from accept to response write, spawn-to-ready times of the
+ * processes, config push durations and inotify events.
+ */
+class Metrics {
+  public:
+    // values only known by their owner (open connections, processes...),
+    // sampled when the metrics are read
+    typedef std::vector<std::pair<std::string, int64_t>> Gauges;
+
+  private:
+    struct CommandMetrics {
+        std::atomic<uint64_t> p_count{0};
+        std::atomic<uint64_t> p_errors{0};
+        std::atomic<int64_t> p_inFlight{0};
+        Histogram p_latency;
+    };
+
+    const std::chrono::steady_clock::time_point m_start;
+    // builtin commands by builtinCommandIndex(), all the custom ones share
+    // the last slot
+    std::array<CommandMetrics, KEKMONITORS_BUILTIN_COMMANDS + 1>
+        m_commands{};
+    Histogram m_spawnToReady;
+    Histogram m_configPush;
+    std::atomic<uint64_t> m_inotifyEvents{0};
+
+    CommandMetrics &command(CommandType cmd);
+    const CommandMetrics &command(CommandType cmd) const;
+    static std::string commandName(size_t index);
+
+  public:
+    Metrics();
+
+    void commandStarted(CommandType cmd);
+    void commandDone(CommandType cmd, ErrorType error,
+                     const std::chrono::microseconds &latency);
+    void spawnReady(const std::chrono::microseconds &duration);
+    void configPushed(const std::chrono::microseconds &duration);
+    void inotifyEvents(uint64_t count);
+
+    json toJson(const Gauges &gauges) const;
+    // prometheus text exposition format, metrics prefixed with kekmonitors_
+    std::string toPrometheus(const Gauges &gauges) const;
+};
+} // namespace kekmonitors
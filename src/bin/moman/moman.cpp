@@ -4,23 +4,20 @@
 #include "spdlog/common.h"
 #include "spdlog/fmt/bundled/core.h"
 #include "spdlog/logger.h"
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/local/stream_protocol.hpp>
-#include <boost/process/detail/on_exit.hpp>
 #include <boost/system/detail/errc.hpp>
 #include <boost/system/detail/error_category.hpp>
-#include <bsoncxx/builder/basic/document.hpp>
-#include <bsoncxx/builder/basic/kvp.hpp>
-#include <bsoncxx/json.hpp>
 #include <cstdint>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <kekmonitors/core.hpp>
 #include <kekmonitors/utils.hpp>
 #include <memory>
-#include <mongocxx/client.hpp>
-#include <mongocxx/exception/query_exception.hpp>
 #include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <sys/inotify.h>
@@ -28,18 +25,18 @@
 #include <utility>
 
 #define REGISTER_CALLBACK(cmd, cb)                                             \
-    { cmd, std::bind(cb, this, ph::_1, ph::_2, ph::_3) }
+    { cmd, CmdDispatcher<MonitorManager>::handler<cb> }
 
 #define M_REGISTER_CALLBACK(cmd, cb)                                           \
     {                                                                          \
-        cmd, std::bind(cb, this, MonitorOrScraper::Monitor, ph::_1, ph::_2,    \
-                       ph::_3)                                                 \
+        cmd, CmdDispatcher<MonitorManager>::boundHandler<                      \
+                 cb, MonitorOrScraper::Monitor>                                \
     }
 
 #define S_REGISTER_CALLBACK(cmd, cb)                                           \
     {                                                                          \
-        cmd, std::bind(cb, this, MonitorOrScraper::Scraper, ph::_1, ph::_2,    \
-                       ph::_3)                                                 \
+        cmd, CmdDispatcher<MonitorManager>::boundHandler<                      \
+                 cb, MonitorOrScraper::Scraper>                                \
     }
 
 using namespace boost::asio;
@@ -52,39 +49,133 @@ static inline bool is_socket(const std::string &path) {
 
 namespace kekmonitors {
 
+// json, msgpack or cbor. Only used with multiplexed connections
+static Encoding getWireEncoding() {
+    const auto encoding = getConfig().p_parser.get<std::string>(
+        "GlobalConfig.wire_encoding", "json");
+    if (encoding == "msgpack")
+        return Encoding::MessagePack;
+    if (encoding == "cbor")
+        return Encoding::Cbor;
+    return Encoding::Json;
+}
+
+// modules imported by the zygote before it forks, comma separated
+static std::vector<std::string> getZygotePreload() {
+    std::vector<std::string> modules;
+    std::istringstream stream{getConfig().p_parser.get<std::string>(
+        "GlobalConfig.zygote_preload", "kekmonitors")};
+    std::string module;
+    while (std::getline(stream, module, ','))
+        if (!module.empty())
+            modules.push_back(module);
+    return modules;
+}
+
+const steady_timer::duration MonitorManager::s_pingRetryInterval =
+    std::chrono::milliseconds(100);
+const uint32_t MonitorManager::s_configSubDirMask =
+    IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM;
+
+static constexpr CmdHandlerEntry s_cmdHandlers[] = {
+    REGISTER_CALLBACK(COMMANDS::PING, &MonitorManager::onPing),
+    REGISTER_CALLBACK(COMMANDS::MM_STOP_MONITOR_MANAGER,
+                      &MonitorManager::shutdown),
+    M_REGISTER_CALLBACK(COMMANDS::MM_ADD_MONITOR, &MonitorManager::onAdd),
+    S_REGISTER_CALLBACK(COMMANDS::MM_ADD_SCRAPER, &MonitorManager::onAdd),
+    REGISTER_CALLBACK(COMMANDS::MM_ADD_MONITOR_SCRAPER,
+                      &MonitorManager::onAddMonitorScraper),
+    M_REGISTER_CALLBACK(COMMANDS::MM_STOP_MONITOR, &MonitorManager::onStop),
+    S_REGISTER_CALLBACK(COMMANDS::MM_STOP_SCRAPER, &MonitorManager::onStop),
+    REGISTER_CALLBACK(COMMANDS::MM_STOP_MONITOR_SCRAPER,
+                      &MonitorManager::onStopMonitorScraper),
+    M_REGISTER_CALLBACK(COMMANDS::MM_ADD_MONITORS, &MonitorManager::onAddMany),
+    S_REGISTER_CALLBACK(COMMANDS::MM_ADD_SCRAPERS, &MonitorManager::onAddMany),
+    M_REGISTER_CALLBACK(COMMANDS::MM_STOP_MONITORS,
+                        &MonitorManager::onStopMany),
+    S_REGISTER_CALLBACK(COMMANDS::MM_STOP_SCRAPERS,
+                        &MonitorManager::onStopMany),
+    REGISTER_CALLBACK(COMMANDS::MM_GET_CONFIG_PUSHES,
+                      &MonitorManager::onGetConfigPushes),
+    REGISTER_CALLBACK(COMMANDS::MM_GET_METRICS,
+                      &MonitorManager::onGetMetrics)};
+
+static constexpr CmdHandlerTable s_cmdHandlerTable =
+    makeCmdHandlerTable(s_cmdHandlers);
+
+// read only, under a shared lock of m_storedObjectsMutex: a status of
+// thousands of objects doesn't hold up the other commands
+static constexpr CmdHandlerEntry s_concurrentCmdHandlers[] = {
+    M_REGISTER_CALLBACK(COMMANDS::MM_GET_MONITOR_STATUS,
+                        &MonitorManager::onGetStatus),
+    S_REGISTER_CALLBACK(COMMANDS::MM_GET_SCRAPER_STATUS,
+                        &MonitorManager::onGetStatus),
+    REGISTER_CALLBACK(COMMANDS::MM_GET_MONITOR_SCRAPER_STATUS,
+                      &MonitorManager::onGetMonitorScraperStatus)};
+
+static constexpr CmdHandlerTable s_concurrentCmdHandlerTable =
+    makeCmdHandlerTable(s_concurrentCmdHandlers);
+
 MonitorManager::MonitorManager(io_context &io)
-    : m_io(io), m_fileWatcher(io),
-      m_unixServer(
-          io, "MonitorManager",
-          CallbackMap{
-              REGISTER_CALLBACK(COMMANDS::PING, &MonitorManager::onPing),
-              REGISTER_CALLBACK(COMMANDS::MM_STOP_MONITOR_MANAGER,
-                                &MonitorManager::shutdown),
-              M_REGISTER_CALLBACK(COMMANDS::MM_ADD_MONITOR,
-                                  &MonitorManager::onAdd),
-              S_REGISTER_CALLBACK(COMMANDS::MM_ADD_SCRAPER,
-                                  &MonitorManager::onAdd),
-              REGISTER_CALLBACK(COMMANDS::MM_ADD_MONITOR_SCRAPER,
-                                &MonitorManager::onAddMonitorScraper),
-              M_REGISTER_CALLBACK(COMMANDS::MM_GET_MONITOR_STATUS,
-                                  &MonitorManager::onGetStatus),
-              S_REGISTER_CALLBACK(COMMANDS::MM_GET_SCRAPER_STATUS,
-                                  &MonitorManager::onGetStatus),
-              REGISTER_CALLBACK(COMMANDS::MM_GET_MONITOR_SCRAPER_STATUS,
-                                &MonitorManager::onGetMonitorScraperStatus),
-              M_REGISTER_CALLBACK(COMMANDS::MM_STOP_MONITOR,
-                                  &MonitorManager::onStop),
-              S_REGISTER_CALLBACK(COMMANDS::MM_STOP_SCRAPER,
-                                  &MonitorManager::onStop),
-              REGISTER_CALLBACK(COMMANDS::MM_STOP_MONITOR_SCRAPER,
-                                &MonitorManager::onStopMonitorScraper)}) {
+    : m_io(io), m_strand(io.get_executor()),
+      m_unixServer(io, "MonitorManager", m_strand, this, s_cmdHandlerTable,
+                   s_concurrentCmdHandlerTable),
+      m_registry(io, m_strand,
+                 getConfig().p_parser.get<std::string>("GlobalConfig.db_path"),
+                 getConfig().p_parser.get<std::string>("GlobalConfig.db_name"),
+                 std::chrono::seconds(getConfig().p_parser.get<unsigned int>(
+                     "GlobalConfig.registry_refresh_interval", 60))),
+      m_batchConcurrency(getConfig().p_parser.get<size_t>(
+          "GlobalConfig.batch_concurrency", 16)),
+      m_addTimeout(getConfig().p_parser.get<unsigned int>(
+          "GlobalConfig.add_timeout_ms", 10000)),
+      m_configDebounce(getConfig().p_parser.get<unsigned int>(
+          "GlobalConfig.config_debounce_ms", 200)),
+      m_pushConcurrency(getConfig().p_parser.get<size_t>(
+          "GlobalConfig.config_push_concurrency", 32)),
+      m_pushTimeout(getConfig().p_parser.get<unsigned int>(
+          "GlobalConfig.config_push_timeout_ms", 3000)),
+      m_maxPushReports(getConfig().p_parser.get<size_t>(
+          "GlobalConfig.config_push_reports", 16)),
+      m_zygote(utils::getConfigBool("GlobalConfig.zygote", false)
+                   ? std::make_unique<Zygote>(io, m_strand, getZygotePreload())
+                   : nullptr),
+      m_stubMonitor(getConfig().p_parser.get<std::string>(
+          "GlobalConfig.stub_monitor", "")),
+      m_fileWatcher(io, m_strand),
+      m_channels(io, m_strand,
+                 utils::getConfigBool("GlobalConfig.multiplexed_connections",
+                                      false)
+                     ? Framing::LengthPrefixed
+                     : Framing::Eof,
+                 getWireEncoding()),
+      m_metricsFile(
+          utils::getConfigBool("GlobalConfig.metrics_file", false)
+              ? getConfig().p_parser.get<std::string>("GlobalConfig.log_path") +
+                    "/moman.prom"
+              : ""),
+      m_metricsInterval(getConfig().p_parser.get<unsigned int>(
+          "GlobalConfig.metrics_interval_s", 15)),
+      m_metricsTimer(io) {
     m_logger = utils::getLogger("MonitorManager");
+    m_unixServer.setMetrics(&m_metrics);
     const auto &config = getConfig();
-    m_dbClient = mongocxx::client{mongocxx::uri{
-        config.p_parser.get<std::string>("GlobalConfig.db_path")}};
-    m_db = m_dbClient[config.p_parser.get<std::string>("GlobalConfig.db_name")];
-    m_monitorRegisterDb = m_db["register.monitors"];
-    m_scraperRegisterDb = m_db["register.scrapers"];
+    m_configs = {{"common", json::object()},
+                 {"monitors", json::object()},
+                 {"scrapers", json::object()}};
+    if (utils::getConfigBool("GlobalConfig.config_snapshot", false)) {
+        auto snapshot = std::make_unique<ConfigSnapshotPublisher>(
+            config.p_parser.get<std::string>(
+                "GlobalConfig.config_snapshot_name", "/kekmonitors-config"));
+        std::error_code ec;
+        if (snapshot->open(ec))
+            m_configSnapshot = std::move(snapshot);
+        else
+            m_logger->error("Failed to open the config snapshot, configs will "
+                            "be sent over the sockets: {}",
+                            ec.message());
+    }
+    m_registry.start();
 
     for (const auto &file :
          fs::directory_iterator{utils::getLocalKekDir() + "/sockets/"}) {
@@ -99,31 +190,38 @@ MonitorManager::MonitorManager(io_context &io)
     m_fileWatcher.inotify.Add(m_fileWatcher.watches.emplace_back(
         config.p_parser.get<std::string>("GlobalConfig.socket_path"),
         IN_CREATE | IN_DELETE));
+    // config files are only read once they've been fully written (or moved
+    // in place), see onInotifyUpdate
     const fs::path configDir = utils::getLocalKekDir() + "/config";
     m_fileWatcher.inotify.Add(m_fileWatcher.watches.emplace_back(
-        configDir.string(), IN_CREATE | IN_DELETE));
+        configDir.string(),
+        IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM));
     for (const auto &configSubDir : {"common", "monitors", "scrapers"}) {
         const fs::path configSubPath = configDir / configSubDir;
         if (fs::is_directory(configSubPath)) {
             m_fileWatcher.inotify.Add(m_fileWatcher.watches.emplace_back(
-                configSubPath.string(), IN_CREATE | IN_DELETE));
+                configSubPath.string(), s_configSubDirMask));
+            // the processes read the files when they start: only later
+            // changes need to be sent
             for (const auto &configFile : {"whitelists.json", "blacklists.json",
                                            "webhooks.json", "configs.json"}) {
                 const fs::path configFilePath = configSubPath / configFile;
-                if (fs::is_regular_file(configFilePath)) {
-                    m_fileWatcher.inotify.Add(
-                        m_fileWatcher.watches.emplace_back(
-                            configFilePath.string(), IN_MODIFY));
-                }
+                if (fs::is_regular_file(configFilePath))
+                    loadConfig(configFilePath.string());
             }
         }
     }
+    if (m_configSnapshot)
+        publishConfigSnapshot();
     m_fileWatcher.inotify.AsyncStartWaitForEvents(
         std::bind(&MonitorManager::onInotifyUpdate, this));
     m_unixServer.startAccepting();
+    if (!m_metricsFile.empty())
+        scheduleMetricsFile();
 }
 
 void MonitorManager::onInotifyUpdate() {
+    m_metrics.inotifyEvents(m_fileWatcher.inotify.GetEventCount());
     for (size_t count = m_fileWatcher.inotify.GetEventCount(); count > 0;
          --count) {
         InotifyEvent event;
@@ -156,70 +254,62 @@ void MonitorManager::onInotifyUpdate() {
                 auto m = eventType & ~IN_ISDIR;
                 switch (m) {
                 case IN_CREATE:
+                case IN_MOVED_TO:
                     if (eventType & IN_ISDIR) {
                         if (std::find(allowedConfigSubDir.begin(),
                                       allowedConfigSubDir.end(),
                                       filename) != allowedConfigSubDir.end()) {
                             m_fileWatcher.inotify.Add(
                                 m_fileWatcher.watches.emplace_back(
-                                    fullEventPath, IN_CREATE | IN_DELETE));
+                                    fullEventPath, s_configSubDirMask));
                             m_logger->info(
                                 "New config folder created and monitored: {}",
                                 fullEventPath);
                         }
                         break;
-                    } else {
-                        if (std::find(allowedFilenames.begin(),
-                                      allowedFilenames.end(),
-                                      filename) != allowedFilenames.end()) {
-                            bool alreadyMonitored{false};
-                            for (const auto &watch : m_fileWatcher.watches) {
-                                if (watch.GetPath() == fullEventPath) {
-                                    alreadyMonitored = true;
-                                    break;
-                                }
-                            }
-                            if (!alreadyMonitored) {
-                                m_fileWatcher.inotify.Add(
-                                    m_fileWatcher.watches.emplace_back(
-                                        fullEventPath, IN_MODIFY));
-                                m_logger->info(
-                                    "New config file created and monitored: {}",
-                                    fullEventPath);
-                                parseAndSendConfigs(fullEventPath, filename);
-                                break;
-                            }
-
-                            // if alreadyMonitored it's probably been edited
-                            // go ahead and update
-                        } else
-                            break;
                     }
-                case IN_MODIFY:
-                case IN_CLOSE_NOWRITE:
+                    // a new file is read on IN_CLOSE_WRITE, once written
+                    if (m == IN_CREATE)
+                        break;
+                    [[fallthrough]];
                 case IN_CLOSE_WRITE:
-                    m_logger->info("File {} has changed", fullEventPath);
-                    parseAndSendConfigs(fullEventPath, filename);
+                    // files directly in config/ are ignored
+                    if (std::find(allowedFilenames.begin(),
+                                  allowedFilenames.end(),
+                                  filename) != allowedFilenames.end() &&
+                        std::find(allowedConfigSubDir.begin(),
+                                  allowedConfigSubDir.end(),
+                                  fs::path{eventPath}.filename().string()) !=
+                            allowedConfigSubDir.end()) {
+                        KDBG("File {} has changed", fullEventPath);
+                        scheduleConfigReload(fullEventPath, filename);
+                    }
                     break;
                 case IN_DELETE:
-                    auto &allowedNames = eventType & IN_ISDIR
-                                             ? allowedConfigSubDir
-                                             : allowedFilenames;
-                    if (std::find(allowedNames.begin(), allowedNames.end(),
-                                  filename) != allowedNames.end()) {
+                case IN_MOVED_FROM:
+                    if (eventType & IN_ISDIR) {
+                        if (std::find(allowedConfigSubDir.begin(),
+                                      allowedConfigSubDir.end(),
+                                      filename) == allowedConfigSubDir.end())
+                            break;
                         for (auto watch = m_fileWatcher.watches.begin();
                              watch != m_fileWatcher.watches.end(); ++watch) {
                             if (watch->GetPath() == fullEventPath) {
                                 m_fileWatcher.inotify.Remove(*watch);
                                 m_fileWatcher.watches.erase(watch);
-                                m_logger->warn("Config {} was removed: {}",
-                                               eventType & IN_ISDIR ? "folder"
-                                                                    : "file",
-                                               fullEventPath);
                                 break;
                             }
                         }
+                    } else {
+                        if (std::find(allowedFilenames.begin(),
+                                      allowedFilenames.end(),
+                                      filename) == allowedFilenames.end())
+                            break;
+                        forgetConfig(fullEventPath);
                     }
+                    m_logger->warn("Config {} was removed: {}",
+                                   eventType & IN_ISDIR ? "folder" : "file",
+                                   fullEventPath);
                     break;
                 }
             }
@@ -227,25 +317,138 @@ void MonitorManager::onInotifyUpdate() {
     }
 }
 
-void MonitorManager::parseAndSendConfigs(const std::string &fullPath,
-                                         const std::string &filename) {
+void MonitorManager::scheduleConfigReload(const std::string &fullPath,
+                                          const std::string &filename) {
+    auto &timer = m_configReloads[fullPath];
+    if (!timer)
+        timer = std::make_shared<steady_timer>(m_io);
+    // restarting the timer cancels the previous wait: only the last event of
+    // a burst reloads the file
+    timer->expires_after(m_configDebounce);
+    timer->async_wait(bind_executor(
+        m_strand, [this, fullPath, filename](const error_code &err) {
+            if (err)
+                return;
+            m_configReloads.erase(fullPath);
+            m_logger->info("File {} has changed", fullPath);
+            parseAndSendConfigs(fullPath, filename);
+        }));
+}
+
+void MonitorManager::cancelConfigReload(const std::string &fullPath) {
+    auto it = m_configReloads.find(fullPath);
+    if (it != m_configReloads.end()) {
+        it->second->cancel();
+        m_configReloads.erase(it);
+    }
+}
+
+// className -> hash of its section
+static MonitorManager::ConfigHashes hashConfigSections(const json &configJson) {
+    MonitorManager::ConfigHashes hashes;
+    hashes.reserve(configJson.size());
+    for (auto it = configJson.cbegin(); it != configJson.cend(); ++it)
+        hashes.emplace(it.key(), std::hash<json>{}(it.value()));
+    return hashes;
+}
+
+bool MonitorManager::readConfigFile(const std::string &fullPath,
+                                    json &configJson) {
     std::ifstream configStream(fullPath);
     if (!configStream.is_open()) {
         m_logger->error("Error while opening file {}", fullPath);
+        return false;
     }
-    json configJson;
     try {
         configStream >> configJson;
         configStream.close();
     } catch (json::parse_error &e) {
         m_logger->warn("Config file {} is not in valid json", fullPath);
-        return;
+        return false;
     }
     if (!configJson.is_object()) {
         m_logger->warn("Config file {} is not a dict", fullPath);
+        return false;
+    }
+    return true;
+}
+
+// the subfolder (common, monitors, scrapers) and the name without
+// extension, where the file is stored in m_configs
+static std::pair<std::string, std::string>
+configKey(const std::string &fullPath) {
+    const fs::path path{fullPath};
+    return {path.parent_path().filename().string(), path.stem().string()};
+}
+
+void MonitorManager::loadConfig(const std::string &fullPath) {
+    json configJson;
+    if (!readConfigFile(fullPath, configJson))
         return;
+    m_configHashes[fullPath] = hashConfigSections(configJson);
+    const auto key = configKey(fullPath);
+    m_configs[key.first][key.second] = std::move(configJson);
+}
+
+void MonitorManager::forgetConfig(const std::string &fullPath) {
+    cancelConfigReload(fullPath);
+    // its sections are reset, like the ones removed from a file that changed
+    std::vector<std::pair<std::string, json>> updates;
+    const auto hashes = m_configHashes.find(fullPath);
+    if (hashes != m_configHashes.end()) {
+        for (const auto &section : hashes->second)
+            updates.emplace_back(section.first, json::object());
+        m_configHashes.erase(hashes);
     }
-    Cmd cmd;
+    const auto key = configKey(fullPath);
+    auto subDir = m_configs.find(key.first);
+    const bool erased =
+        subDir != m_configs.end() && subDir->erase(key.second);
+    if (!erased && updates.empty())
+        return;
+    m_logger->info("{}: {} sections removed", fullPath, updates.size());
+    sendConfigUpdates(fullPath, key.first,
+                      configCommand(key.first,
+                                    fs::path{fullPath}.filename().string()),
+                      std::move(updates));
+}
+
+uint64_t MonitorManager::publishConfigSnapshot() {
+    std::error_code ec;
+    const auto generation = m_configSnapshot->publish(m_configs, ec);
+    if (!generation)
+        m_logger->error("Failed to publish the config snapshot: {}",
+                        ec.message());
+    else
+        KDBG("Published config snapshot {}", generation);
+    return generation;
+}
+
+// the command setting the sections of filename, in config/configSubDir
+static CommandType configCommand(const std::string &configSubDir,
+                                 const std::string &filename) {
+    const bool common = configSubDir == "common";
+    if (filename == "webhooks.json")
+        return common ? COMMANDS::SET_COMMON_WEBHOOKS
+                      : COMMANDS::SET_SPECIFIC_WEBHOOKS;
+    if (filename == "whitelists.json")
+        return common ? COMMANDS::SET_COMMON_WHITELIST
+                      : COMMANDS::SET_SPECIFIC_WHITELIST;
+    if (filename == "blacklists.json")
+        return common ? COMMANDS::SET_COMMON_BLACKLIST
+                      : COMMANDS::SET_SPECIFIC_BLACKLIST;
+    if (filename == "configs.json")
+        return common ? COMMANDS::SET_COMMON_CONFIG
+                      : COMMANDS::SET_SPECIFIC_CONFIG;
+    // not reached: only the files in allowedFilenames are read
+    return Cmd{}.cmd();
+}
+
+void MonitorManager::parseAndSendConfigs(const std::string &fullPath,
+                                         const std::string &filename) {
+    json configJson;
+    if (!readConfigFile(fullPath, configJson))
+        return;
     std::string configSubDir;
     bool flag{false};
     size_t lastSlash{0};
@@ -265,87 +468,106 @@ void MonitorManager::parseAndSendConfigs(const std::string &fullPath,
         return;
     }
 
-    if (filename == "webhooks.json")
-        cmd.setCmd(configSubDir == "common" ? COMMANDS::SET_COMMON_WEBHOOKS
-                                            : COMMANDS::SET_SPECIFIC_WEBHOOKS);
-    else if (filename == "whitelists.json")
-        cmd.setCmd(configSubDir == "common" ? COMMANDS::SET_COMMON_WHITELIST
-                                            : COMMANDS::SET_SPECIFIC_WHITELIST);
-    else if (filename == "blacklists.json")
-        cmd.setCmd(configSubDir == "common" ? COMMANDS::SET_COMMON_BLACKLIST
-                                            : COMMANDS::SET_SPECIFIC_BLACKLIST);
-    else if (filename == "configs.json")
-        cmd.setCmd(configSubDir == "common" ? COMMANDS::SET_COMMON_CONFIG
-                                            : COMMANDS::SET_SPECIFIC_CONFIG);
-
-    for (json::const_iterator it = configJson.cbegin(); it != configJson.cend();
-         ++it) {
-        const std::string &className = it.key();
-        cmd.setPayload(configJson.at(className));
-        auto s = cmd.toString();
-        if (configSubDir == "monitors" || configSubDir == "common") {
-            sendCmdIfProcess(MonitorOrScraper::Monitor, cmd, className);
-        };
-        if (configSubDir == "scrapers" || configSubDir == "common") {
-            sendCmdIfProcess(MonitorOrScraper::Scraper, cmd, className);
+    // only the sections that changed since the last time the file was read
+    // are sent, and sections that were removed are reset
+    auto newHashes = hashConfigSections(configJson);
+    auto &oldHashes = m_configHashes[fullPath];
+    std::vector<std::pair<std::string, json>> updates;
+    size_t removed = 0;
+    for (const auto &section : newHashes) {
+        const auto old = oldHashes.find(section.first);
+        if (old == oldHashes.end() || old->second != section.second)
+            updates.emplace_back(section.first, configJson.at(section.first));
+    }
+    for (const auto &section : oldHashes) {
+        if (!newHashes.count(section.first)) {
+            updates.emplace_back(section.first, json::object());
+            ++removed;
         }
     }
+    oldHashes = std::move(newHashes);
+    m_logger->info("{}: {} sections changed, {} removed", fullPath,
+                   updates.size() - removed, removed);
+    if (updates.empty())
+        return;
+
+    m_configs[configSubDir][fs::path{filename}.stem().string()] =
+        std::move(configJson);
+    sendConfigUpdates(fullPath, configSubDir,
+                      configCommand(configSubDir, filename),
+                      std::move(updates));
 }
 
-void MonitorManager::sendCmdIfProcess(MonitorOrScraper m, const Cmd &cmd,
-                                      const std::string &className) {
+void MonitorManager::sendConfigUpdates(
+    const std::string &fullPath, const std::string &configSubDir,
+    CommandType cmd, std::vector<std::pair<std::string, json>> &&updates) {
+    // with a snapshot the processes only need to be told to map the new
+    // generation
+    const uint64_t generation =
+        m_configSnapshot ? publishConfigSnapshot() : 0;
+    // every target of the same cmd writes the same encoded bytes
+    std::vector<FanOut::Target> targets;
+    SharedCmd::Ptr sharedCmd;
+    if (generation) {
+        Cmd snapshotCmd;
+        snapshotCmd.setCmd(COMMANDS::CONFIG_SNAPSHOT_UPDATED);
+        snapshotCmd.setPayload(json{{"name", m_configSnapshot->name()},
+                                    {"generation", generation}});
+        sharedCmd = SharedCmd::create(std::move(snapshotCmd));
+    }
+    for (auto &update : updates) {
+        if (!generation) {
+            Cmd sectionCmd;
+            sectionCmd.setCmd(cmd);
+            sectionCmd.setPayload(std::move(update.second));
+            sharedCmd = SharedCmd::create(std::move(sectionCmd));
+        }
+        if (configSubDir == "monitors" || configSubDir == "common")
+            addPushTarget(MonitorOrScraper::Monitor, sharedCmd, update.first,
+                          targets);
+        if (configSubDir == "scrapers" || configSubDir == "common")
+            addPushTarget(MonitorOrScraper::Scraper, sharedCmd, update.first,
+                          targets);
+    }
+    if (!targets.empty())
+        pushConfig(std::move(targets),
+                   generation ? fmt::format("{} (snapshot {})", fullPath,
+                                            generation)
+                              : fullPath);
+}
+
+void MonitorManager::addPushTarget(MonitorOrScraper m,
+                                   const SharedCmd::Ptr &cmd,
+                                   const std::string &className,
+                                   std::vector<FanOut::Target> &targets) {
     auto &storedObjects =
         m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
     const auto it = storedObjects.find(className);
-    if (it != storedObjects.end()) {
-        if (it->second.p_process && it->second.p_endpoint) {
-            auto connection = Connection::create(m_io);
-            const auto mstring =
-                m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper";
-            connection->p_endpoint.async_connect(
-                *(it->second.p_endpoint), [=](const error_code &errc) {
-                    if (errc) {
-                        if (errc != boost::system::errc::operation_canceled) {
-                            m_logger->error(
-                                "Error trying to connect to {} {}: {}", mstring,
-                                className, errc.message());
-                        }
-                        return;
-                    }
-                    connection->asyncWriteCmd(cmd, [=](const error_code &errc,
-                                                       Connection::Ptr
-                                                           connection) {
-                        if (errc) {
-                            if (errc !=
-                                boost::system::errc::operation_canceled) {
-                                m_logger->error(
-                                    "Error trying to write cmd to {} {}: {}",
-                                    mstring, className, errc.message());
-                            }
-                            return;
-                        }
-                        connection->asyncReadResponse([=](const error_code
-                                                              &errc,
-                                                          const Response &r,
-                                                          Connection::Ptr) {
-                            if (errc) {
-                                if (errc !=
-                                    boost::system::errc::operation_canceled) {
-                                    m_logger->error("Error trying to read "
-                                                    "response from {} {}: {}",
-                                                    mstring, className,
-                                                    errc.message());
-                                }
-                                return;
-                            }
-                            if (r.error()) {
-                                m_logger->warn(r.toString());
-                            }
-                        });
-                    });
-                });
-        }
-    }
+    if (it != storedObjects.end() && it->second.p_process &&
+        it->second.p_endpoint)
+        targets.push_back({m, className, *it->second.p_endpoint, cmd});
+}
+
+void MonitorManager::pushConfig(std::vector<FanOut::Target> &&targets,
+                                std::string description) {
+    FanOut::create(
+        m_io, m_strand, m_channels, std::move(targets), m_pushConcurrency,
+        m_pushTimeout, m_nextPushId++, std::move(description),
+        [this](const FanOut::Report &report) {
+            m_metrics.configPushed(report.p_duration);
+            const auto failed = report.count(FanOut::Outcome::Failed);
+            const auto timedOut = report.count(FanOut::Outcome::TimedOut);
+            m_logger->log(
+                failed || timedOut ? spdlog::level::warn : spdlog::level::info,
+                "Config push {} ({}): {} delivered, {} failed, {} timed out "
+                "in {} ms",
+                report.p_id, report.p_description,
+                report.count(FanOut::Outcome::Delivered), failed, timedOut,
+                report.p_duration.count() / 1000);
+            m_pushReports.push_back(report.toJson());
+            while (m_pushReports.size() > m_maxPushReports)
+                m_pushReports.pop_front();
+        });
 }
 
 void MonitorManager::onProcessExit(int exit, const std::error_code &ec,
@@ -364,6 +586,10 @@ void MonitorManager::onProcessExit(int exit, const std::error_code &ec,
             m == MonitorOrScraper::Monitor ? _storedMonitors : _storedScrapers;
         auto it = map.find(className);
         if (it != map.end()) {
+            // fails a pending onAdd right away
+            if (it->second.p_isBeingAdded && it->second.p_onAddTimer)
+                it->second.p_onAddTimer->cancel();
+            std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
             removeStoredProcess(map, it);
         }
     }
@@ -371,56 +597,48 @@ void MonitorManager::onProcessExit(int exit, const std::error_code &ec,
 
 void MonitorManager::verifySocketIsCommunicating(
     MonitorOrScraper m, const std::string &socketFullPath,
-    const std::string &className, std::function<void()> &&on_success) {
-
-    auto newConn = Connection::create(m_io);
-    const auto &&on_connect = [=]() {
-        Cmd newCmd;
-        newCmd.setCmd(COMMANDS::PING);
-        newConn->quickWriteCmd(
-            newCmd,
-            [=](const Response &resp) {
-                if (resp.error()) {
-                    m_logger->debug("{} {} responded with error",
-                                    m == MonitorOrScraper::Monitor ? "Monitor"
-                                                                   : "Scraper",
-                                    className);
-                    return;
-                }
-                m_logger->info("{} {} found",
-                               m == MonitorOrScraper::Monitor ? "Monitor"
-                                                              : "Scraper",
-                               className);
-                on_success();
-            },
-            [=](const error_code &errc) {
-                m_logger->warn("Failed to communicate with {} {}, error: {}",
-                               m == MonitorOrScraper::Monitor ? "Monitor"
-                                                              : "Scraper",
-                               className, errc.message());
-            });
-    };
-
-    error_code errc;
-    auto ep = local::stream_protocol::endpoint{socketFullPath};
-    newConn->p_endpoint.connect(ep, errc);
-    if (errc) {
-        steady_timer timer{m_io, std::chrono::milliseconds(500)};
-        timer.async_wait([=](const error_code &timer_errc) {
-            if (!timer_errc) {
-                error_code socket_errc;
-                newConn->p_endpoint.connect(ep, socket_errc);
-                if (!socket_errc)
-                    on_connect();
-                else
-                    m_logger->debug("{} {} found but not available",
-                                    m == MonitorOrScraper::Monitor ? "Monitor"
-                                                                   : "Scraper",
-                                    className);
-            }
-        });
-        return;
-    }
+    const std::string &className, std::function<void()> &&on_success,
+    unsigned int retries) {
+    const auto mstring = m == MonitorOrScraper::Monitor ? "Monitor" : "Scraper";
+    auto channel =
+        m_channels.get(local::stream_protocol::endpoint{socketFullPath});
+    Cmd cmd;
+    cmd.setCmd(COMMANDS::PING);
+
+    channel->asyncSendCmd(cmd, [=](const error_code &errc,
+                                   const Response &resp) {
+        if (errc == error::operation_aborted)
+            return;
+        if (errc && retries) {
+            // the socket file is created before the process starts listening
+            // on it: give it some time and try again
+            m_logger->debug("{} {} found but not available yet, retrying",
+                            mstring, className);
+            auto timer =
+                std::make_shared<steady_timer>(m_io, s_pingRetryInterval);
+            // the handler owns the timer: destroying it would abort the wait
+            timer->async_wait(bind_executor(
+                m_strand,
+                [=, timer = timer](const error_code &timer_errc) mutable {
+                    if (!timer_errc)
+                        verifySocketIsCommunicating(
+                            m, socketFullPath, className,
+                            std::function<void()>{on_success}, retries - 1);
+                }));
+            return;
+        }
+        if (errc) {
+            m_logger->warn("Failed to communicate with {} {}, error: {}",
+                           mstring, className, errc.message());
+            return;
+        }
+        if (resp.error()) {
+            m_logger->debug("{} {} responded with error", mstring, className);
+            return;
+        }
+        m_logger->info("{} {} found", mstring, className);
+        on_success();
+    });
 };
 
 void MonitorManager::checkSocketAndUpdateList(const std::string &socketFullPath,
@@ -432,7 +650,7 @@ void MonitorManager::checkSocketAndUpdateList(const std::string &socketFullPath,
     }
     auto dotIndex = socketName.rfind(".");
     if (dotIndex == std::string::npos) {
-        m_logger->error("Invalid socket path: " + socketFullPath);
+        m_logger->error("Invalid socket path: {}", socketFullPath);
         return;
     }
     std::string socketPrefix = socketName.substr(0, dotIndex);
@@ -452,21 +670,33 @@ void MonitorManager::checkSocketAndUpdateList(const std::string &socketFullPath,
     case IN_CREATE:
         if (it != map.end()) {
             auto &storedObject = it->second;
-            storedObject.p_endpoint =
-                std::make_unique<local::stream_protocol::endpoint>(
-                    socketFullPath);
+            {
+                std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
+                storedObject.p_endpoint =
+                    std::make_unique<local::stream_protocol::endpoint>(
+                        socketFullPath);
+            }
             if (storedObject.p_isBeingAdded) {
+                // keep trying for as long as onAdd waits
                 verifySocketIsCommunicating(
-                    m, socketFullPath, className, [=]() {
-                        auto &storedObject = it->second;
-                storedObject.p_confirmAdded = true;
-                storedObject.p_onAddTimer->cancel();
+                    m, socketFullPath, className,
+                    [=]() {
+                        auto &map = m == MonitorOrScraper::Monitor
+                                        ? _storedMonitors
+                                        : _storedScrapers;
+                        auto it = map.find(className);
+                        if (it == map.end() || !it->second.p_isBeingAdded)
+                            return;
+                        it->second.p_confirmAdded = true;
+                        if (it->second.p_onAddTimer)
+                            it->second.p_onAddTimer->cancel();
                         m_logger->info(fmt::format(
                             "{} {} added",
                             m == MonitorOrScraper::Monitor ? "Monitor"
                                                            : "Scraper",
                             className));
-                    });
+                    },
+                    m_addTimeout / s_pingRetryInterval);
             } else {
                 m_logger->warn(fmt::format(
                     "{} {}: found socket but not synchronized with "
@@ -482,6 +712,7 @@ void MonitorManager::checkSocketAndUpdateList(const std::string &socketFullPath,
                 socketFullPath);
                 auto &map = m == MonitorOrScraper::Monitor ? _storedMonitors
                                                            : _storedScrapers;
+                std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
                 auto pair =
             map.emplace(std::make_pair(className, std::move(obj)));
             });
@@ -489,7 +720,9 @@ void MonitorManager::checkSocketAndUpdateList(const std::string &socketFullPath,
         break;
     case IN_DELETE:
         if (it != map.end()) {
-            KDBG(fmt::format("Socket {} was removed", className));
+            KDBG("Socket {} was removed", className);
+            m_channels.remove(local::stream_protocol::endpoint{socketFullPath});
+            std::unique_lock<std::shared_mutex> lock(m_storedObjectsMutex);
             removeStoredSocket(map, it);
             break;
         }
@@ -501,9 +734,8 @@ void terminateProcesses(
     for (auto it = storedObjects.begin(); it != storedObjects.end();) {
         auto &storedProcess = it->second.p_process;
         if (storedProcess) {
-            auto &process = storedProcess->process();
-            if (process.running())
-                process.terminate();
+            if (storedProcess->running())
+                storedProcess->terminate();
             removeStoredProcess(storedObjects, it);
         } else
             ++it;
@@ -512,12 +744,45 @@ void terminateProcesses(
 
 MonitorManager::~MonitorManager() {}
 
-} // namespace kekmonitors
+Metrics::Gauges MonitorManager::metricsGauges() {
+    const auto countProcesses =
+        [](const std::unordered_map<std::string, StoredObject> &objects) {
+            return std::count_if(objects.begin(), objects.end(),
+                                 [](const auto &object) {
+                                     return object.second.p_process != nullptr;
+                                 });
+        };
+    return {{"open_connections", m_unixServer.openConnections()},
+            {"running_monitors", countProcesses(_storedMonitors)},
+            {"running_scrapers", countProcesses(_storedScrapers)}};
+}
+
+void MonitorManager::scheduleMetricsFile() {
+    m_metricsTimer.expires_after(m_metricsInterval);
+    m_metricsTimer.async_wait(
+        bind_executor(m_strand, [this](const error_code &err) {
+            if (err)
+                return;
+            writeMetricsFile();
+            scheduleMetricsFile();
+        }));
+}
 
-int main() {
-    io_context io;
-    kekmonitors::init();
-    kekmonitors::MonitorManager moman(io);
-    io.run();
-    return 0;
+void MonitorManager::writeMetricsFile() {
+    // written aside and renamed, so that scrapers never see a partial file
+    const auto tmpPath = m_metricsFile + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        file << m_metrics.toPrometheus(metricsGauges());
+        if (!file) {
+            m_logger->warn("Failed to write the metrics to {}", tmpPath);
+            return;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmpPath, m_metricsFile, ec);
+    if (ec)
+        m_logger->warn("Failed to write the metrics to {}: {}", m_metricsFile,
+                       ec.message());
 }
+} // namespace kekmonitors
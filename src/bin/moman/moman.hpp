@@ -1,14 +1,20 @@
 #pragma once
+#include "registry.hpp"
+#include "fanout.hpp"
 #include "server.hpp"
+#include "zygote.hpp"
 #include <boost/asio/detail/cstdint.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <kekmonitors/channel.hpp>
 #include <kekmonitors/core.hpp>
 #include <kekmonitors/inotify-cxx.h>
 #include <kekmonitors/msg.hpp>
+#include <kekmonitors/payloads.hpp>
 #include <kekmonitors/process.hpp>
+#include <kekmonitors/snapshot.hpp>
+#include <deque>
 #include <list>
-#include <mongocxx/client.hpp>
-#include <mongocxx/instance.hpp>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 
@@ -16,7 +22,7 @@ namespace kekmonitors {
 
 class FileWatcher {
   public:
-    FileWatcher(io_context &io) : inotify(io) {}
+    FileWatcher(io_context &io, const Strand &strand) : inotify(io, strand) {}
     Inotify inotify;
     std::list<InotifyWatch> watches;
 };
@@ -52,62 +58,174 @@ class StoredObject {
 };
 
 class MonitorManager {
+  public:
+    // className -> hash of its section of a config file
+    typedef std::unordered_map<std::string, size_t> ConfigHashes;
+
   private:
     io_context &m_io;
+    // io_context::run() may be called from many threads: all the state below
+    // is only touched from handlers running on m_strand, see
+    // m_storedObjectsMutex for the exception
+    Strand m_strand;
+    // before m_unixServer, which records every command in it
+    Metrics m_metrics;
     UnixServer m_unixServer;
     std::shared_ptr<spdlog::logger> m_logger{nullptr};
-    mongocxx::client m_dbClient;
-    mongocxx::database m_db;
-    mongocxx::collection m_monitorRegisterDb;
-    mongocxx::collection m_scraperRegisterDb;
+    Registry m_registry;
+    // how many names of a batch command are processed at the same time
+    const size_t m_batchConcurrency;
+    // how long onAdd waits for the process to answer on its socket
+    const std::chrono::milliseconds m_addTimeout;
+    // quiet time after the last inotify event of a config file before it is
+    // reloaded
+    const std::chrono::milliseconds m_configDebounce;
+    // how many processes a config change is sent to at the same time, and
+    // how long each of them has to answer
+    const size_t m_pushConcurrency;
+    const std::chrono::milliseconds m_pushTimeout;
+    // how many reports of the last config pushes are kept
+    const size_t m_maxPushReports;
+    // nullptr unless GlobalConfig.zygote is set
+    std::unique_ptr<Zygote> m_zygote;
+    // GlobalConfig.stub_monitor: when set, it is run with the socket name as
+    // only argument instead of looking up and starting the python scripts
+    const std::string m_stubMonitor;
     std::atomic<bool> m_fileWatcherStop{false};
     FileWatcher m_fileWatcher;
+    // connections to the monitors/scrapers sockets
+    ChannelPool m_channels;
+    // the maps are still only changed on m_strand, but MM_GET_*_STATUS read
+    // them from the connections' strands: adding or removing an entry, or
+    // the process or endpoint of one, needs a unique lock, reading them
+    // outside of m_strand a shared one
+    std::shared_mutex m_storedObjectsMutex;
     std::unordered_map<std::string, StoredObject> _storedMonitors;
     std::unordered_map<std::string, StoredObject> _storedScrapers;
+    // config file path -> debounce timer of its pending reload
+    std::unordered_map<std::string, std::shared_ptr<steady_timer>>
+        m_configReloads;
+    // config file path -> sections sent the last time it was read
+    std::unordered_map<std::string, ConfigHashes> m_configHashes;
+    // the parsed config files, {"common": {"configs": {...}, ...}, ...}
+    json m_configs;
+    // nullptr unless GlobalConfig.config_snapshot is set
+    std::unique_ptr<ConfigSnapshotPublisher> m_configSnapshot;
+    // FanOut::Report::toJson() of the last config pushes, oldest first
+    std::deque<json> m_pushReports;
+    uint64_t m_nextPushId{1};
+    // prometheus text file rewritten every m_metricsInterval, empty unless
+    // GlobalConfig.metrics_file is set
+    const std::string m_metricsFile;
+    const std::chrono::seconds m_metricsInterval;
+    steady_timer m_metricsTimer;
 
     void onInotifyUpdate();
+    // fills response and returns false if className is already running or
+    // being added
+    bool checkCanBeAdded(MonitorOrScraper m, const std::string &className,
+                         Response &response);
+    void spawn(MonitorOrScraper m, const std::string &className,
+               const std::string &scriptPath, const UserResponseCallback &cb,
+               Connection::Ptr connection);
+    Process::Ptr startProcess(MonitorOrScraper m, const std::string &className,
+                              const std::vector<std::string> &argv,
+                              std::error_code &ec);
+    // stores process and waits for it to answer on its socket
+    // spawnedAt: when spawn was called
+    void onSpawned(MonitorOrScraper m, const std::string &className,
+                   Process::Ptr process, const std::error_code &ec,
+                   std::chrono::steady_clock::time_point spawnedAt,
+                   const UserResponseCallback &cb, Connection::Ptr connection);
     void onProcessExit(int exit, const std::error_code &, MonitorOrScraper,
                        const std::string &className);
 
     void checkSocketAndUpdateList(const std::string &socketFullPath,
                        std::string socketName = "", uint32_t mask = 0);
 
+    // events watched on the config/{common,monitors,scrapers} folders
+    static const uint32_t s_configSubDirMask;
+    void scheduleConfigReload(const std::string &fullPath,
+                              const std::string &filename);
+    void cancelConfigReload(const std::string &fullPath);
+    // false if the file isn't a json object
+    bool readConfigFile(const std::string &fullPath, json &configJson);
+    void loadConfig(const std::string &fullPath);
+    // the file was removed
+    void forgetConfig(const std::string &fullPath);
+    // returns the new generation, 0 on error
+    uint64_t publishConfigSnapshot();
     void parseAndSendConfigs(const std::string &fullPath,
                              const std::string &filename);
+    // publishes the snapshot, if any, and sends the updated sections
+    // (className -> section) of a file of config/configSubDir to the running
+    // processes: the sections with cmd, or only the new generation
+    void sendConfigUpdates(const std::string &fullPath,
+                           const std::string &configSubDir, CommandType cmd,
+                           std::vector<std::pair<std::string, json>> &&updates);
+
+    // adds className to targets if it's running and has a socket
+    void addPushTarget(MonitorOrScraper m, const SharedCmd::Ptr &cmd,
+                       const std::string &className,
+                       std::vector<FanOut::Target> &targets);
+    void pushConfig(std::vector<FanOut::Target> &&targets,
+                    std::string description);
+
+    Metrics::Gauges metricsGauges();
+    void scheduleMetricsFile();
+    void writeMetricsFile();
 
-    void sendCmdIfProcess(const MonitorOrScraper, const Cmd &cmd,
-                 const std::string &className);
+    // between two PINGs of verifySocketIsCommunicating
+    static const steady_timer::duration s_pingRetryInterval;
 
     void verifySocketIsCommunicating(MonitorOrScraper m,
                                      const std::string &socketFullPath,
                                      const std::string &className,
-                                     std::function<void()> &&on_success);
+                                     std::function<void()> &&on_success,
+                                     unsigned int retries = 5);
 
   public:
     MonitorManager() = delete;
     explicit MonitorManager(boost::asio::io_context &io);
+    // payload of MM_GET_*_STATUS:
+    // {"monitored_processes": {...}, "monitored_sockets": {...}}
+    static json statusPayload(
+        const std::unordered_map<std::string, StoredObject> &storedObjects);
     ~MonitorManager();
     void shutdown(const Cmd &cmd, const UserResponseCallback &&cb,
                   Connection::Ptr connection);
     void onPing(const Cmd &cmd, const UserResponseCallback &&cb,
                 Connection::Ptr connection);
-    void onAdd(MonitorOrScraper m, const Cmd &cmd,
+    void onAdd(MonitorOrScraper m, const NamePayload &payload,
                const UserResponseCallback &&cb, Connection::Ptr connection);
-    void onAddMonitorScraper(const Cmd &cmd, const UserResponseCallback &&cb,
+    void onAddMonitorScraper(const NamePayload &payload,
+                             const UserResponseCallback &&cb,
                              Connection::Ptr connection);
-    void onStop(MonitorOrScraper m, const Cmd &cmd,
+    void onStop(MonitorOrScraper m, const NamePayload &payload,
                 const UserResponseCallback &&cb, Connection::Ptr connection);
-    void onStopMonitorScraper(const Cmd &cmd, const UserResponseCallback &&cb,
+    void onStopMonitorScraper(const NamePayload &payload,
+                              const UserResponseCallback &&cb,
                               Connection::Ptr connection);
+    void onAddMany(MonitorOrScraper m, const NamesPayload &payload,
+                   const UserResponseCallback &&cb, Connection::Ptr connection);
+    void onStopMany(MonitorOrScraper m, const NamesPayload &payload,
+                    const UserResponseCallback &&cb,
+                    Connection::Ptr connection);
     void onGetStatus(MonitorOrScraper m, const Cmd &cmd,
                      const UserResponseCallback &&cb,
                      Connection::Ptr connection);
     void onGetMonitorScraperStatus(const Cmd &cmd,
                                    const UserResponseCallback &&cb,
                                    Connection::Ptr connection);
+    void onGetConfigPushes(const ConfigPushesPayload &payload,
+                           const UserResponseCallback &&cb,
+                           Connection::Ptr connection);
+    void onGetMetrics(const Cmd &cmd, const UserResponseCallback &&cb,
+                      Connection::Ptr connection);
 };
 
-typedef std::function<void(MonitorManager *, MonitorOrScraper m, const Cmd &cmd,
+// the command is bound by the caller
+typedef std::function<void(MonitorManager *, MonitorOrScraper m,
                            const UserResponseCallback &&cb, Connection::Ptr)>
     MonitorManagerCallback;
 typedef std::function<void(const kekmonitors::Response &,
@@ -119,8 +237,7 @@ class MonitorScraperCompletion
 
   private:
     bool m_bothCompleted{false};
-    io_context &m_io;
-    const Cmd m_cmd;
+    Strand m_strand;
     const DoubleResponseCallback m_completionCb;
     const MonitorManagerCallback m_momanCb;
     MonitorManager *m_moman;
@@ -129,7 +246,7 @@ class MonitorScraperCompletion
 
   public:
     MonitorScraperCompletion() = delete;
-    MonitorScraperCompletion(io_context &io, MonitorManager *moman, Cmd cmd,
+    MonitorScraperCompletion(const Strand &strand, MonitorManager *moman,
                              MonitorManagerCallback &&momanCb,
                              DoubleResponseCallback &&completionCb,
                              std::shared_ptr<Connection> connection);
@@ -138,7 +255,7 @@ class MonitorScraperCompletion
 
     void run();
 
-    static void create(io_context &io, MonitorManager *moman, const Cmd &cmd,
+    static void create(const Strand &strand, MonitorManager *moman,
                        MonitorManagerCallback &&momanCb,
                        DoubleResponseCallback &&completionCb,
                        std::shared_ptr<Connection> connection);
@@ -147,6 +264,44 @@ class MonitorScraperCompletion
     void checkForCompletion(const Response &response);
 };
 
+/*
+ * Runs an operation for every name of a batch command, with at most
+ * m_maxInFlight of them pending at the same time, then calls m_completionCb
+ * with the responses in the same order as the names.
+ */
+class BatchCompletion : public std::enable_shared_from_this<BatchCompletion> {
+  public:
+    typedef std::function<void(const Response &)> DoneCallback;
+    typedef std::function<void(const std::string &name, DoneCallback &&)>
+        Operation;
+    typedef std::function<void(const std::vector<std::string> &names,
+                               const std::vector<Response> &responses)>
+        CompletionCallback;
+
+  private:
+    Strand m_strand;
+    const std::vector<std::string> m_names;
+    const size_t m_maxInFlight;
+    const Operation m_operation;
+    const CompletionCallback m_completionCb;
+    std::vector<Response> m_responses;
+    size_t m_next{0};
+    size_t m_inFlight{0};
+    size_t m_completed{0};
+
+    void startNext();
+    void onDone(size_t index, const Response &response);
+
+  public:
+    BatchCompletion(const Strand &strand, std::vector<std::string> names,
+                    size_t maxInFlight, Operation &&operation,
+                    CompletionCallback &&completionCb);
+
+    static void create(const Strand &strand, std::vector<std::string> names,
+                       size_t maxInFlight, Operation &&operation,
+                       CompletionCallback &&completionCb);
+};
+
 template <typename Map, typename Iterator>
 void removeStoredSocket(Map &map, Iterator &it) {
     auto &stored = it->second;
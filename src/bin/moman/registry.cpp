@@ -0,0 +1,184 @@
+#include "registry.hpp"
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <kekmonitors/utils.hpp>
+#include <mongocxx/exception/exception.hpp>
+#include <mongocxx/options/find.hpp>
+
+namespace kekmonitors {
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+const size_t Registry::s_workerThreads = 2;
+
+static const char *collectionName(MonitorOrScraper m) {
+    return m == MonitorOrScraper::Monitor ? "register.monitors"
+                                          : "register.scrapers";
+}
+
+static std::optional<std::string> pathOf(const bsoncxx::document::view &doc) {
+    const auto path = doc["path"];
+    if (!path || path.type() != bsoncxx::type::k_utf8)
+        return {};
+    return std::string{path.get_utf8().value};
+}
+
+template <typename Cursor>
+static void fillPaths(Cursor &&docs, Registry::PathMap &paths) {
+    for (const auto &doc : docs) {
+        const auto name = doc["name"];
+        const auto path = pathOf(doc);
+        if (name && name.type() == bsoncxx::type::k_utf8 && path)
+            paths.emplace(std::string{name.get_utf8().value}, *path);
+    }
+}
+
+Registry::Registry(io_context &io, const Strand &strand,
+                   const std::string &dbPath, std::string dbName,
+                   const steady_timer::duration &refreshInterval)
+    : m_strand(strand), m_pool(mongocxx::uri{dbPath}),
+      m_dbName(std::move(dbName)), m_workers(s_workerThreads),
+      m_refreshTimer(io), m_refreshInterval(refreshInterval) {
+    m_logger = utils::getLogger("Registry");
+}
+
+Registry::~Registry() { m_workers.join(); }
+
+Registry::Cache &Registry::cacheFor(MonitorOrScraper m) {
+    return m == MonitorOrScraper::Monitor ? m_monitors : m_scrapers;
+}
+
+void Registry::start() {
+    m_isStopped = false;
+    reload();
+}
+
+void Registry::stop() {
+    m_isStopped = true;
+    m_refreshTimer.cancel();
+}
+
+void Registry::scheduleReload() {
+    m_refreshTimer.expires_after(m_refreshInterval);
+    m_refreshTimer.async_wait(bind_executor(
+        m_strand, [this](const error_code &err) {
+            if (!err && !m_isStopped)
+                reload();
+        }));
+}
+
+void Registry::reload() {
+    post(m_workers, [this] {
+        Cache monitors, scrapers;
+        std::string error;
+        try {
+            auto client = m_pool.acquire();
+            auto db = (*client)[m_dbName];
+            mongocxx::options::find options;
+            options.projection(make_document(kvp("name", 1), kvp("path", 1)));
+            for (const auto m :
+                 {MonitorOrScraper::Monitor, MonitorOrScraper::Scraper}) {
+                fillPaths(db[collectionName(m)].find(make_document(), options),
+                          m == MonitorOrScraper::Monitor ? monitors
+                                                         : scrapers);
+            }
+        } catch (const mongocxx::exception &e) {
+            error = e.what();
+        }
+        post(m_strand, [this, monitors = std::move(monitors),
+                        scrapers = std::move(scrapers), error]() mutable {
+            if (error.empty()) {
+                m_monitors = std::move(monitors);
+                m_scrapers = std::move(scrapers);
+                m_logger->debug("Loaded {} monitors and {} scrapers",
+                                m_monitors.size(), m_scrapers.size());
+            } else
+                // keep serving the old entries
+                m_logger->warn("Failed to reload the registry: {}", error);
+            if (!m_isStopped)
+                scheduleReload();
+        });
+    });
+}
+
+void Registry::asyncLookup(MonitorOrScraper m, const std::string &className,
+                           LookupCallback &&cb) {
+    const auto &cache = cacheFor(m);
+    const auto it = cache.find(className);
+    if (it != cache.end()) {
+        cb(it->second, "");
+        return;
+    }
+    post(m_workers, [this, m, className, cb = std::move(cb)]() mutable {
+        std::optional<std::string> path;
+        std::string error;
+        try {
+            auto client = m_pool.acquire();
+            const auto doc = (*client)[m_dbName][collectionName(m)].find_one(
+                make_document(kvp("name", className)));
+            if (doc)
+                path = pathOf(doc->view());
+        } catch (const mongocxx::exception &e) {
+            error = e.what();
+        }
+        post(m_strand, [this, m, className, path, error,
+                        cb = std::move(cb)] {
+            if (path)
+                cacheFor(m)[className] = *path;
+            cb(path, error);
+        });
+    });
+}
+
+void Registry::asyncLookupMany(MonitorOrScraper m,
+                               const std::vector<std::string> &classNames,
+                               ManyLookupCallback &&cb) {
+    PathMap paths;
+    std::vector<std::string> missing;
+    const auto &cache = cacheFor(m);
+    for (const auto &className : classNames) {
+        const auto it = cache.find(className);
+        if (it != cache.end())
+            paths.emplace(className, it->second);
+        else
+            missing.push_back(className);
+    }
+    if (missing.empty()) {
+        cb(paths, "");
+        return;
+    }
+    post(m_workers, [this, m, paths = std::move(paths),
+                     missing = std::move(missing),
+                     cb = std::move(cb)]() mutable {
+        PathMap found;
+        std::string error;
+        try {
+            auto client = m_pool.acquire();
+            bsoncxx::builder::basic::array names;
+            for (const auto &className : missing)
+                names.append(className);
+            auto collection = (*client)[m_dbName][collectionName(m)];
+            fillPaths(collection.find(make_document(
+                          kvp("name", make_document(kvp("$in", names))))),
+                      found);
+        } catch (const mongocxx::exception &e) {
+            error = e.what();
+        }
+        post(m_strand, [this, m, paths = std::move(paths),
+                        found = std::move(found), error,
+                        cb = std::move(cb)]() mutable {
+            auto &cache = cacheFor(m);
+            for (const auto &entry : found) {
+                cache[entry.first] = entry.second;
+                paths.insert(entry);
+            }
+            cb(paths, error);
+        });
+    });
+}
+} // namespace kekmonitors
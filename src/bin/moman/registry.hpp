@@ -0,0 +1,74 @@
+#pragma once
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <kekmonitors/connection.hpp>
+#include <kekmonitors/core.hpp>
+#include <mongocxx/pool.hpp>
+#include <optional>
+#include <spdlog/logger.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace boost::asio;
+
+namespace kekmonitors {
+
+/*
+ * In memory copy of register.monitors and register.scrapers (name -> path).
+ * The whole collections are reloaded every m_refreshInterval, names that are
+ * not in the cache yet are looked up on demand. The database is only ever
+ * queried from m_workers, never from the strand, where everything else
+ * (including the callbacks) happens.
+ */
+class Registry {
+  public:
+    // name -> path
+    typedef std::unordered_map<std::string, std::string> PathMap;
+    // path is empty if the name is not registered, error is not empty if the
+    // database couldn't be queried
+    typedef std::function<void(const std::optional<std::string> &path,
+                               const std::string &error)>
+        LookupCallback;
+    // names that are not registered are missing from paths
+    typedef std::function<void(const PathMap &paths, const std::string &error)>
+        ManyLookupCallback;
+
+  private:
+    typedef PathMap Cache;
+
+    static const size_t s_workerThreads;
+
+    Strand m_strand;
+    mongocxx::pool m_pool;
+    const std::string m_dbName;
+    thread_pool m_workers;
+    steady_timer m_refreshTimer;
+    const steady_timer::duration m_refreshInterval;
+    std::shared_ptr<spdlog::logger> m_logger{nullptr};
+    Cache m_monitors;
+    Cache m_scrapers;
+    bool m_isStopped{false};
+
+    Cache &cacheFor(MonitorOrScraper m);
+    void scheduleReload();
+
+  public:
+    Registry(io_context &io, const Strand &strand, const std::string &dbPath,
+             std::string dbName, const steady_timer::duration &refreshInterval);
+    ~Registry();
+
+    // loads the collections and keeps reloading them
+    void start();
+    void stop();
+    void reload();
+
+    void asyncLookup(MonitorOrScraper m, const std::string &className,
+                     LookupCallback &&cb);
+    // the names missing from the cache are looked up with a single query
+    void asyncLookupMany(MonitorOrScraper m,
+                         const std::vector<std::string> &classNames,
+                         ManyLookupCallback &&cb);
+};
+} // namespace kekmonitors
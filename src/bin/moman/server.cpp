@@ -1,5 +1,8 @@
 #include "server.hpp"
+#include <algorithm>
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
 #include <iostream>
 #include <kekmonitors/msg.hpp>
 #include <kekmonitors/utils.hpp>
@@ -18,11 +21,14 @@ std::string getServerPath(const std::string &socketName) {
 }
 
 UnixServer::UnixServer(io_context &io, const std::string &socketName)
-    : UnixServer(io, socketName, {}){};
+    : UnixServer(io, socketName, Strand(io.get_executor()), nullptr, {}){};
 
 UnixServer::UnixServer(io_context &io, const std::string &socketName,
-                       const CallbackMap &callbacks)
-    : m_io(io), p_callbacks(callbacks) {
+                       const Strand &strand, void *context,
+                       const CmdHandlerTable &handlers,
+                       const CmdHandlerTable &concurrentHandlers)
+    : m_io(io), m_strand(strand), m_handlersContext(context),
+      m_handlers(handlers), m_concurrentHandlers(concurrentHandlers) {
     m_logger = utils::getLogger("UnixServer");
     m_serverPath = getServerPath(socketName);
 #ifdef KEKMONITORS_DEBUG
@@ -37,17 +43,24 @@ UnixServer::UnixServer(io_context &io, const std::string &socketName,
 UnixServer::~UnixServer(){};
 
 void UnixServer::startAccepting() {
-    auto connection = Connection::create(m_io);
+    auto connection = Connection::create(m_io, Framing::Detect);
     m_acceptor->async_accept(
         connection->p_endpoint,
-        std::bind(&UnixServer::onConnect, this, ph::_1, connection));
+        bind_executor(m_strand, std::bind(&UnixServer::onConnect, this,
+                                          ph::_1, connection)));
 };
 
 void UnixServer::onConnect(const error_code &err,
                            std::shared_ptr<Connection> &connection) {
     if (!err) {
-        connection->asyncReadCmd(std::bind(&UnixServer::_handleCallback, this,
-                                           ph::_1, ph::_2, connection));
+        if (m_metrics) {
+            // prune when the vector would grow, so it stays O(1) amortized
+            if (m_connections.size() == m_connections.capacity())
+                openConnections();
+            m_connections.push_back(connection);
+        }
+        readCmd(connection, std::chrono::seconds(1),
+                std::chrono::steady_clock::now());
         startAccepting();
     } else {
         if (err != error::operation_aborted && m_acceptor->is_open()) {
@@ -58,34 +71,98 @@ void UnixServer::onConnect(const error_code &err,
     }
 }
 
-void UnixServer::_handleCallback(const error_code &err, const Cmd &cmd,
-                                 std::shared_ptr<Connection> connection) {
+void UnixServer::readCmd(Connection::Ptr connection,
+                         const steady_timer::duration &timeout,
+                         std::chrono::steady_clock::time_point acceptedAt) {
+    // the command is read on the connection's strand, handled on m_strand
+    // unless its handler is in m_concurrentHandlers
+    connection->asyncReadCmd(
+        [this, acceptedAt](const error_code &err, const Cmd &cmd,
+                           Connection::Ptr connection) {
+            // the commands pipelined after the first one are timed from when
+            // they were read: the connection may have been idle before
+            const auto startedAt =
+                acceptedAt == std::chrono::steady_clock::time_point{}
+                    ? std::chrono::steady_clock::now()
+                    : acceptedAt;
+            // answered by respond in _handleCallback
+            if (!err)
+                connection->requestStarted();
+            const size_t builtinIndex = builtinCommandIndex(cmd.cmd());
+            if (!err && builtinIndex < m_concurrentHandlers.size() &&
+                m_concurrentHandlers[builtinIndex]) {
+                _handleCallback(err, cmd, connection, startedAt);
+                return;
+            }
+            post(m_strand, std::bind(&UnixServer::_handleCallback, this, err,
+                                     cmd, connection, startedAt));
+        },
+        timeout);
+}
+
+void UnixServer::_handleCallback(
+    const error_code &err, const Cmd &cmd,
+    std::shared_ptr<Connection> connection,
+    std::chrono::steady_clock::time_point startedAt) {
     if (err) {
-        if (err != error::operation_aborted)
+        // eof: a persistent client closed its connection
+        if (err != error::operation_aborted && err != error::eof)
             m_logger->error("Error while reading CMD: {}", err.message());
         return;
     }
-    auto command = static_cast<uint32_t>(cmd.cmd());
-    try {
-        m_logger->info("Received cmd " + utils::commandToString(cmd.cmd()));
-    } catch (std::out_of_range &) {
-        m_logger->info("Received cmd " +
-                       std::to_string(static_cast<uint32_t>(cmd.cmd())));
-    }
-    try {
-        p_callbacks.at(cmd.cmd())(
-            cmd,
-            std::bind(&Connection::asyncWriteResponse, connection, ph::_1,
-                      [](const error_code &, Connection::Ptr) {}),
-            connection);
-    } catch (std::out_of_range &e) {
-        m_logger->warn("Cmd " + std::to_string(command) +
-                       " was not registered");
-        Response resp;
-        resp.setError(ERRORS::UNRECOGNIZED_COMMAND);
+    // framed clients keep the connection open and can pipeline more
+    // commands while this one is being handled
+    if (connection->framing() == Framing::LengthPrefixed)
+        readCmd(connection, Connection::s_idleTimeout);
+    const auto command = cmd.cmd();
+    const auto requestId = cmd.requestId();
+    const auto encoding = cmd.encoding();
+    const auto &commandNames = commandStringMap().left;
+    const auto commandName = commandNames.find(command);
+    if (commandName != commandNames.end())
+        m_logger->info("Received cmd {}", commandName->second);
+    else
+        m_logger->info("Received cmd {}", command);
+
+    if (m_metrics)
+        m_metrics->commandStarted(command);
+    UserResponseCallback respond = [connection, requestId, encoding, command,
+                                    startedAt, metrics = m_metrics](
+                                       const Response &response,
+                                       Connection::Ptr) {
+        const auto error = response.error();
         connection->asyncWriteResponse(
-            resp, [](const error_code &, Connection::Ptr) {});
+            response, requestId, encoding,
+            [=](const error_code &err, Connection::Ptr) {
+                connection->requestDone();
+                if (metrics)
+                    metrics->commandDone(
+                        command, err ? ERRORS::OTHER_ERROR : error,
+                        std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - startedAt));
+            });
+    };
+    const size_t builtinIndex = builtinCommandIndex(command);
+    if (builtinIndex < m_handlers.size()) {
+        const CmdHandler handler = m_concurrentHandlers[builtinIndex]
+                                       ? m_concurrentHandlers[builtinIndex]
+                                       : m_handlers[builtinIndex];
+        if (handler) {
+            handler(m_handlersContext, cmd, std::move(respond), connection);
+            return;
+        }
+    }
+    if (isCustomCommand(command)) {
+        const size_t index = command - KEKMONITORS_FIRST_CUSTOM_COMMAND;
+        if (index < m_customCallbacks.size() && m_customCallbacks[index]) {
+            m_customCallbacks[index](cmd, std::move(respond), connection);
+            return;
+        }
     }
+    m_logger->warn("Cmd {} was not registered", command);
+    Response resp;
+    resp.setError(ERRORS::UNRECOGNIZED_COMMAND);
+    respond(resp, connection);
 }
 
 void UnixServer::shutdown() {
@@ -94,6 +171,30 @@ void UnixServer::shutdown() {
     ::unlink(m_serverPath.c_str());
 }
 
+void UnixServer::setCustomCallback(CommandType cmd,
+                                   userCmdCallback &&callback) {
+    if (!isCustomCommand(cmd)) {
+        m_logger->error("Cmd {} is not a custom command", cmd);
+        return;
+    }
+    const size_t index = cmd - KEKMONITORS_FIRST_CUSTOM_COMMAND;
+    if (index >= m_customCallbacks.size())
+        m_customCallbacks.resize(index + 1);
+    m_customCallbacks[index] = std::move(callback);
+}
+
+void UnixServer::setMetrics(Metrics *metrics) { m_metrics = metrics; }
+
+size_t UnixServer::openConnections() {
+    m_connections.erase(
+        std::remove_if(m_connections.begin(), m_connections.end(),
+                       [](const std::weak_ptr<Connection> &connection) {
+                           return connection.expired();
+                       }),
+        m_connections.end());
+    return m_connections.size();
+}
+
 void UnixServer::setServerPath(const std::string &socketName) {
     m_serverPath = getServerPath(socketName);
 }
@@ -1,11 +1,16 @@
 #pragma once
+#include "metrics.hpp"
+#include <array>
 #include <boost/asio/io_context.hpp>
 #include <chrono>
 #include <kekmonitors/config.hpp>
 #include <kekmonitors/connection.hpp>
 #include <kekmonitors/core.hpp>
 #include <kekmonitors/msg.hpp>
+#include <kekmonitors/payloads.hpp>
 #include <spdlog/logger.h>
+#include <type_traits>
+#include <vector>
 
 using namespace boost::asio;
 
@@ -16,31 +21,148 @@ typedef std::function<void(const kekmonitors::Response &, Connection::Ptr)>
 typedef std::function<void(const kekmonitors::Cmd &, UserResponseCallback &&,
                            Connection::Ptr)>
     userCmdCallback;
-typedef std::map<const kekmonitors::CommandType, userCmdCallback> CallbackMap;
+
+// handlers for the builtin commands are plain function pointers taking the
+// object they were registered for, so that the whole table can be built at
+// compile time (see makeCmdHandlerTable)
+typedef void (*CmdHandler)(void *, const kekmonitors::Cmd &,
+                           UserResponseCallback &&, Connection::Ptr);
+// indexed by builtinCommandIndex()
+typedef std::array<CmdHandler, KEKMONITORS_BUILTIN_COMMANDS> CmdHandlerTable;
+
+struct CmdHandlerEntry {
+    CommandType cmd;
+    CmdHandler handler;
+};
+
+// the first argument of a handler after the bound one, if any: the Cmd, or
+// the payload struct it wants the Cmd payload parsed into
+template <typename Method> struct HandlerPayload;
+template <typename T, typename P>
+struct HandlerPayload<void (T::*)(const P &, const UserResponseCallback &&,
+                                  Connection::Ptr)> {
+    typedef P type;
+};
+template <typename T, typename Arg, typename P>
+struct HandlerPayload<void (T::*)(Arg, const P &, const UserResponseCallback &&,
+                                  Connection::Ptr)> {
+    typedef P type;
+};
+
+template <typename T> class CmdDispatcher {
+  private:
+    template <typename Payload>
+    static bool parseCmdPayload(const kekmonitors::Cmd &cmd, Payload &payload,
+                                Response &response) {
+        if (cmd.payloadError()) {
+            response.setError(ERRORS::BAD_PAYLOAD);
+            response.setInfo("The payload is not valid json.");
+            return false;
+        }
+        return parsePayload(cmd.payload(), payload, response);
+    }
+
+  public:
+    // calls (obj->*Method)(cmd, cb, connection), or with the payload parsed
+    // into the struct Method takes instead of cmd. If the payload is not
+    // valid, the error is answered without calling Method
+    template <auto Method>
+    static void handler(void *obj, const kekmonitors::Cmd &cmd,
+                        UserResponseCallback &&cb, Connection::Ptr connection) {
+        typedef typename HandlerPayload<decltype(Method)>::type Payload;
+        if constexpr (std::is_same_v<Payload, Cmd>)
+            (static_cast<T *>(obj)->*Method)(cmd, std::move(cb),
+                                             std::move(connection));
+        else {
+            Payload payload;
+            Response response;
+            if (!parseCmdPayload(cmd, payload, response)) {
+                cb(response, connection);
+                return;
+            }
+            (static_cast<T *>(obj)->*Method)(payload, std::move(cb),
+                                             std::move(connection));
+        }
+    }
+
+    // calls (obj->*Method)(Arg, cmd, cb, connection), the same way
+    template <auto Method, auto Arg>
+    static void boundHandler(void *obj, const kekmonitors::Cmd &cmd,
+                             UserResponseCallback &&cb,
+                             Connection::Ptr connection) {
+        typedef typename HandlerPayload<decltype(Method)>::type Payload;
+        if constexpr (std::is_same_v<Payload, Cmd>)
+            (static_cast<T *>(obj)->*Method)(Arg, cmd, std::move(cb),
+                                             std::move(connection));
+        else {
+            Payload payload;
+            Response response;
+            if (!parseCmdPayload(cmd, payload, response)) {
+                cb(response, connection);
+                return;
+            }
+            (static_cast<T *>(obj)->*Method)(Arg, payload, std::move(cb),
+                                             std::move(connection));
+        }
+    }
+};
+
+template <size_t N>
+constexpr CmdHandlerTable
+makeCmdHandlerTable(const CmdHandlerEntry (&entries)[N]) {
+    CmdHandlerTable table{};
+    for (size_t i = 0; i < N; i++)
+        table[builtinCommandIndex(entries[i].cmd)] = entries[i].handler;
+    return table;
+}
 
 class UnixServer {
   private:
     std::unique_ptr<local::stream_protocol::acceptor> m_acceptor{nullptr};
     std::string m_serverPath{};
     io_context &m_io;
+    // accepts and command handlers run here, connections use their own
+    Strand m_strand;
     std::shared_ptr<spdlog::logger> m_logger{nullptr};
+    // passed as first argument to every handler in m_handlers
+    void *m_handlersContext{nullptr};
+    CmdHandlerTable m_handlers{};
+    // handlers that synchronize by themselves: they run on the connection's
+    // strand and don't wait behind the ones on m_strand
+    CmdHandlerTable m_concurrentHandlers{};
+    // custom commands, indexed by their offset from
+    // KEKMONITORS_FIRST_CUSTOM_COMMAND
+    std::vector<userCmdCallback> m_customCallbacks{};
+    // nullptr unless setMetrics was called
+    Metrics *m_metrics{nullptr};
+    // accepted connections, pruned once in a while
+    std::vector<std::weak_ptr<Connection>> m_connections{};
 
-  public:
-    CallbackMap p_callbacks{};
-
-  private:
     void onConnect(const error_code &err,
                    std::shared_ptr<Connection> &connection);
-    void _handleCallback(const error_code &, const Cmd &cmd, Connection::Ptr);
+    // acceptedAt: when connection was accepted if this is its first command
+    void readCmd(Connection::Ptr connection,
+                 const steady_timer::duration &timeout,
+                 std::chrono::steady_clock::time_point acceptedAt = {});
+    void _handleCallback(const error_code &, const Cmd &cmd, Connection::Ptr,
+                         std::chrono::steady_clock::time_point startedAt);
 
   public:
     UnixServer(io_context &io, const std::string &socketName);
     UnixServer(io_context &io, const std::string &socketName,
-               const CallbackMap &callbacks);
+               const Strand &strand, void *context,
+               const CmdHandlerTable &handlers,
+               const CmdHandlerTable &concurrentHandlers = {});
     ~UnixServer();
     void startAccepting();
     void shutdown();
 
+    void setCustomCallback(CommandType cmd, userCmdCallback &&callback);
+    // every command is recorded in metrics, which must outlive the server
+    void setMetrics(Metrics *metrics);
+    // connections accepted and not closed yet. Must be called on m_strand
+    size_t openConnections();
+
     void setServerPath(const std::string &socketName);
     std::string &serverPath();
 };
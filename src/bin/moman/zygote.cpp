@@ -0,0 +1,268 @@
+#include "zygote.hpp"
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/buffers_iterator.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <kekmonitors/utils.hpp>
+#include <nlohmann/json.hpp>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace kekmonitors {
+
+using json = nlohmann::json;
+
+// run with python -c, sys.argv[1:] are the modules to preload
+static const char *s_zygoteSource = R"(
+import atexit, json, os, runpy, socket, sys
+
+for module in sys.argv[1:]:
+    try:
+        __import__(module)
+    except Exception:
+        pass
+
+control = socket.socket(fileno=os.dup(0))
+requests = control.makefile("r")
+devnull = os.open(os.devnull, os.O_RDWR)
+os.dup2(devnull, 0)
+
+
+def run(argv):
+    # the script must not keep the control socket open
+    requests.close()
+    control.close()
+    os.close(devnull)
+    sys.argv = argv
+    sys.path[0] = os.path.dirname(os.path.abspath(argv[0]))
+    code = 0
+    try:
+        runpy.run_path(argv[0], run_name="__main__")
+    except SystemExit as e:
+        code = e.code if isinstance(e.code, int) else int(e.code is not None)
+    except BaseException:
+        code = 1
+    atexit._run_exitfuncs()
+    os._exit(code)
+
+
+def fork(argv):
+    r, w = os.pipe()
+    child = os.fork()
+    if child == 0:
+        os.close(r)
+        try:
+            pid = os.fork()
+        except BaseException:
+            os._exit(1)
+        if pid == 0:
+            os.close(w)
+            run(argv)
+        os.write(w, str(pid).encode())
+        os._exit(0)
+    os.close(w)
+    pid = os.read(r, 32)
+    os.close(r)
+    # once child is reaped the script has been reparented to the manager
+    os.waitpid(child, 0)
+    if not pid:
+        raise OSError("fork failed")
+    return int(pid)
+
+
+for line in requests:
+    request = json.loads(line)
+    reply = {"id": request["id"]}
+    try:
+        reply["pid"] = fork(request["argv"])
+    except Exception as e:
+        reply["error"] = str(e)
+    control.sendall((json.dumps(reply) + "\n").encode())
+)";
+
+Zygote::Zygote(io_context &io, const Strand &strand,
+               std::vector<std::string> preload)
+    : m_io(io), m_strand(strand), m_preload(std::move(preload)),
+      m_control(io), m_sigchld(io), m_reapTimer(io) {
+    m_logger = utils::getLogger("Zygote");
+}
+
+Zygote::~Zygote() { stop(); }
+
+bool Zygote::start() {
+    if (m_process)
+        return true;
+    const auto python = utils::getPythonExecutable();
+    if (python.empty())
+        return false;
+    // the scripts are orphaned on purpose: make sure they end up here and not
+    // under init. Descendants orphaned by the scripts themselves end up here
+    // too, and are reaped by reapOrphans()
+    static const bool isSubreaper = [this] {
+        if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+            m_logger->error("Failed to become a child subreaper: {}",
+                            std::strerror(errno));
+            return false;
+        }
+        return true;
+    }();
+    if (!isSubreaper)
+        return false;
+    if (!m_reaping) {
+        error_code ec;
+        m_sigchld.add(SIGCHLD, ec);
+        if (ec) {
+            m_logger->error("Failed to handle SIGCHLD: {}", ec.message());
+            return false;
+        }
+        m_reaping = true;
+        reapOrphans();
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+        m_logger->error("Failed to create the control socket: {}",
+                        std::strerror(errno));
+        return false;
+    }
+    std::vector<std::string> args{"-c", s_zygoteSource};
+    args.insert(args.end(), m_preload.begin(), m_preload.end());
+    std::error_code ec;
+    m_process = Process::create(
+        m_io, m_strand, "Zygote", python.string(), args,
+        [this](int exit, const std::error_code &) { onExit(exit); }, ec,
+        fds[1]);
+    ::close(fds[1]);
+    if (!m_process) {
+        ::close(fds[0]);
+        m_logger->error("Failed to start the zygote: {}", ec.message());
+        return false;
+    }
+    m_control.assign(local::stream_protocol{}, fds[0]);
+    m_logger->info("Started zygote with PID {}", m_process->id());
+    read();
+    return true;
+}
+
+void Zygote::reapOrphans() {
+    m_sigchld.async_wait(
+        bind_executor(m_strand, [this](const error_code &err, int) {
+            if (err)
+                return;
+            reapUntracked();
+            reapOrphans();
+        }));
+}
+
+void Zygote::reapUntracked() {
+    m_reapTimer.cancel();
+    if (Process::reapUntracked())
+        return;
+    // the tracked child is reaped by its Process shortly, there are no
+    // more SIGCHLDs for the ones after it
+    m_reapTimer.expires_after(std::chrono::milliseconds(100));
+    m_reapTimer.async_wait(
+        bind_executor(m_strand, [this](const error_code &err) {
+            if (!err)
+                reapUntracked();
+        }));
+}
+
+void Zygote::asyncFork(const std::vector<std::string> &argv,
+                       ForkCallback &&cb) {
+    if (!start()) {
+        cb(-1, "Couldn't start the zygote.");
+        return;
+    }
+    const auto id = m_nextId++;
+    m_pending.emplace(id, std::move(cb));
+    m_writeQueue.push_back(json{{"id", id}, {"argv", argv}}.dump() + "\n");
+    if (m_writeQueue.size() == 1)
+        write();
+}
+
+void Zygote::read() {
+    async_read_until(
+        m_control, m_readBuffer, '\n',
+        bind_executor(m_strand, [this](const error_code &err, size_t size) {
+            if (err == error::operation_aborted)
+                return;
+            if (err) {
+                m_logger->warn("Lost the zygote control socket: {}",
+                               err.message());
+                m_process = nullptr;
+                failAll("The zygote control socket was closed.");
+                return;
+            }
+            const auto begin = buffers_begin(m_readBuffer.data());
+            const std::string line(begin, begin + size);
+            m_readBuffer.consume(size);
+            onReply(line);
+            read();
+        }));
+}
+
+void Zygote::write() {
+    async_write(m_control, buffer(m_writeQueue.front()),
+                bind_executor(m_strand, [this](const error_code &err, size_t) {
+                    // on error the socket is closed and the queue cleared
+                    // by read() or onExit()
+                    if (err)
+                        return;
+                    m_writeQueue.pop_front();
+                    if (!m_writeQueue.empty())
+                        write();
+                }));
+}
+
+void Zygote::onReply(const std::string &line) {
+    try {
+        const auto reply = json::parse(line);
+        auto it = m_pending.find(reply.at("id").get<uint32_t>());
+        if (it == m_pending.end())
+            return;
+        auto cb = std::move(it->second);
+        m_pending.erase(it);
+        if (reply.contains("pid"))
+            cb(reply["pid"].get<pid_t>(), "");
+        else
+            cb(-1, reply.value("error", "Unknown error."));
+    } catch (json::exception &e) {
+        m_logger->warn("Invalid reply from the zygote: {}", e.what());
+    }
+}
+
+void Zygote::onExit(int exit) {
+    m_logger->warn("Zygote exited with code {}", exit);
+    // called by m_process itself, which has nothing left to do after this
+    m_process = nullptr;
+    failAll("The zygote exited.");
+}
+
+void Zygote::failAll(const std::string &error) {
+    error_code ec;
+    m_control.close(ec);
+    m_readBuffer.consume(m_readBuffer.size());
+    m_writeQueue.clear();
+    auto pending = std::move(m_pending);
+    m_pending.clear();
+    for (auto &request : pending)
+        request.second(-1, error);
+}
+
+void Zygote::stop() {
+    error_code ec;
+    m_sigchld.cancel(ec);
+    m_reapTimer.cancel();
+    m_reaping = false;
+    m_pending.clear();
+    m_writeQueue.clear();
+    m_control.close(ec);
+    // forked scripts are not children of the zygote anymore
+    m_process = nullptr;
+}
+} // namespace kekmonitors
@@ -0,0 +1,74 @@
+#pragma once
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <deque>
+#include <kekmonitors/core.hpp>
+#include <kekmonitors/process.hpp>
+#include <spdlog/logger.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace boost::asio;
+
+namespace kekmonitors {
+
+/*
+ * A python interpreter that has already imported m_preload and forks itself
+ * to run a script, which saves the interpreter startup and the imports on
+ * every add. Requests and replies are json lines on a socketpair that is the
+ * stdin of the zygote.
+ * Scripts are double forked so that they are reparented to this process
+ * (which becomes a child subreaper) and can be tracked with Process::adopt
+ * like any other child. Being a subreaper, this process also inherits what
+ * the scripts and their children orphan: those are reaped on SIGCHLD.
+ * The zygote is started on the first fork and restarted if it dies. Must only
+ * be used from m_strand.
+ */
+class Zygote {
+  public:
+    // pid is -1 and error is set if the script couldn't be forked
+    typedef std::function<void(pid_t pid, const std::string &error)>
+        ForkCallback;
+
+  private:
+    io_context &m_io;
+    Strand m_strand;
+    const std::vector<std::string> m_preload;
+    Process::Ptr m_process{nullptr};
+    local::stream_protocol::socket m_control;
+    streambuf m_readBuffer;
+    std::deque<std::string> m_writeQueue;
+    std::unordered_map<uint32_t, ForkCallback> m_pending;
+    uint32_t m_nextId{0};
+    std::shared_ptr<spdlog::logger> m_logger{nullptr};
+    signal_set m_sigchld;
+    // retries reaping while a tracked child is in the way, see
+    // Process::reapUntracked
+    steady_timer m_reapTimer;
+    bool m_reaping{false};
+
+    // once this process is a subreaper
+    void reapOrphans();
+    void reapUntracked();
+    bool start();
+    void read();
+    void write();
+    void onReply(const std::string &line);
+    void onExit(int exit);
+    void failAll(const std::string &error);
+
+  public:
+    Zygote(io_context &io, const Strand &strand,
+           std::vector<std::string> preload);
+    ~Zygote();
+
+    // forks the zygote and runs argv[0] with argv as sys.argv
+    void asyncFork(const std::vector<std::string> &argv, ForkCallback &&cb);
+    // kills the zygote, pending callbacks are never called
+    void stop();
+};
+} // namespace kekmonitors
@@ -0,0 +1,327 @@
+/*
+ * Load generator for a running moman: every client keeps its own framed
+ * connection and sends one command after the other, picked at random with the
+ * given weights, until --requests commands were sent or --duration elapsed.
+ * add-stop adds a monitor with a name never used before and stops it once
+ * added: set GlobalConfig.stub_monitor to the stubmonitor executable so that
+ * neither python nor the database are needed.
+ */
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <chrono>
+#include <fmt/format.h>
+#include <iostream>
+#include <kekmonitors/config.hpp>
+#include <kekmonitors/connection.hpp>
+#include <kekmonitors/stats.hpp>
+#include <kekmonitors/utils.hpp>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kekmonitors;
+
+typedef std::chrono::steady_clock Clock;
+
+enum Op { OP_PING, OP_STATUS, OP_ADD, OP_STOP, OP_COUNT };
+
+static const char *s_opNames[OP_COUNT] = {"ping", "status", "add", "stop"};
+
+static const COMMANDS s_statusCommands[] = {
+    COMMANDS::MM_GET_MONITOR_STATUS, COMMANDS::MM_GET_SCRAPER_STATUS,
+    COMMANDS::MM_GET_MONITOR_SCRAPER_STATUS};
+
+// adds wait for the process to answer, up to GlobalConfig.add_timeout_ms
+static const std::chrono::seconds s_responseTimeout{30};
+
+struct Options {
+    size_t clients{16};
+    unsigned int threads{1};
+    // per client, 0 means until duration elapsed
+    size_t requests{0};
+    std::chrono::seconds duration{10};
+    // weights of the mix
+    double ping{8};
+    double status{2};
+    double addStop{1};
+    bool printJson{false};
+};
+
+struct Client {
+    size_t id;
+    Connection::Ptr connection;
+    std::mt19937 rng;
+    std::discrete_distribution<int> mix;
+    // in ns
+    std::array<std::vector<double>, OP_COUNT> latencies;
+    std::array<size_t, OP_COUNT> errors{};
+    size_t sent{0};
+    size_t nextMonitor{0};
+};
+
+class Bench {
+  private:
+    const Options m_options;
+    io_context &m_io;
+    const local::stream_protocol::endpoint m_endpoint;
+    std::vector<Client> m_clients;
+    Clock::time_point m_deadline;
+    std::atomic<size_t> m_failedClients{0};
+
+    bool isDone(const Client &client) const {
+        return m_options.requests ? client.sent >= m_options.requests
+                                  : Clock::now() >= m_deadline;
+    }
+
+    void next(Client &client) {
+        if (isDone(client)) {
+            client.connection->close();
+            return;
+        }
+        Cmd cmd;
+        switch (client.mix(client.rng)) {
+        case OP_PING:
+            cmd.setCmd(COMMANDS::PING);
+            send(client, OP_PING, cmd, [this, &client] { next(client); });
+            break;
+        case OP_STATUS:
+            cmd.setCmd(s_statusCommands[client.rng() % 3]);
+            send(client, OP_STATUS, cmd, [this, &client] { next(client); });
+            break;
+        default: {
+            const json payload{{"name", fmt::format("MomanBench{}x{}",
+                                                    client.id,
+                                                    client.nextMonitor++)}};
+            cmd.setCmd(COMMANDS::MM_ADD_MONITOR);
+            cmd.setPayload(payload);
+            send(client, OP_ADD, cmd, [this, &client, payload] {
+                Cmd stop;
+                stop.setCmd(COMMANDS::MM_STOP_MONITOR);
+                stop.setPayload(payload);
+                send(client, OP_STOP, stop, [this, &client] { next(client); });
+            });
+        }
+        }
+    }
+
+    void send(Client &client, Op op, const Cmd &cmd,
+              std::function<void()> &&then) {
+        client.sent++;
+        const auto sentAt = Clock::now();
+        client.connection->asyncWriteCmd(
+            cmd, [this, &client, op, sentAt,
+                  then = std::move(then)](const error_code &err,
+                                          Connection::Ptr connection) {
+                if (err) {
+                    fail(client, err);
+                    return;
+                }
+                connection->asyncReadResponse(
+                    [this, &client, op, sentAt,
+                     then = std::move(then)](const error_code &err,
+                                             const Response &response,
+                                             Connection::Ptr) {
+                        if (err) {
+                            fail(client, err);
+                            return;
+                        }
+                        client.latencies[op].push_back(
+                            std::chrono::duration<double, std::nano>(
+                                Clock::now() - sentAt)
+                                .count());
+                        if (response.error())
+                            client.errors[op]++;
+                        then();
+                    },
+                    s_responseTimeout);
+            });
+    }
+
+    void fail(Client &client, const error_code &err) {
+        std::cerr << "Client " << client.id << " stopped: " << err.message()
+                  << std::endl;
+        m_failedClients++;
+        client.connection->close();
+    }
+
+  public:
+    Bench(io_context &io, const Options &options,
+          const local::stream_protocol::endpoint &endpoint)
+        : m_options(options), m_io(io), m_endpoint(endpoint) {
+        m_clients.resize(m_options.clients);
+        for (size_t i = 0; i < m_clients.size(); i++) {
+            auto &client = m_clients[i];
+            client.id = i;
+            client.rng.seed(static_cast<std::mt19937::result_type>(i));
+            client.mix = std::discrete_distribution<int>{
+                m_options.ping, m_options.status, m_options.addStop};
+        }
+    }
+
+    // returns false if any client couldn't connect
+    bool connect() {
+        for (auto &client : m_clients) {
+            client.connection =
+                Connection::create(m_io, Framing::LengthPrefixed);
+            error_code ec;
+            client.connection->p_endpoint.connect(m_endpoint, ec);
+            if (ec) {
+                std::cerr << "Couldn't connect to " << m_endpoint.path()
+                          << ": " << ec.message() << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void start() {
+        m_deadline = Clock::now() + m_options.duration;
+        for (auto &client : m_clients)
+            post(m_io, [this, &client] { next(client); });
+    }
+
+    json results(double elapsedS) const {
+        json ops = json::object();
+        size_t total = 0;
+        for (int op = 0; op < OP_COUNT; op++) {
+            std::vector<double> latencies;
+            size_t errors = 0;
+            for (const auto &client : m_clients) {
+                latencies.insert(latencies.end(),
+                                 client.latencies[op].begin(),
+                                 client.latencies[op].end());
+                errors += client.errors[op];
+            }
+            if (latencies.empty())
+                continue;
+            total += latencies.size();
+            json stats{{"count", latencies.size()}, {"errors", errors}};
+            stats.update(latencyStats(std::move(latencies)));
+            ops[s_opNames[op]] = std::move(stats);
+        }
+        return {{"clients", m_options.clients},
+                {"threads", m_options.threads},
+                {"failed_clients", m_failedClients.load()},
+                {"elapsed_s", elapsedS},
+                {"requests", total},
+                {"requests_per_s", total / elapsedS},
+                {"ops", ops}};
+    }
+};
+
+static void printResults(const json &results) {
+    std::cout << fmt::format(
+                     "{} clients, {} threads, {} requests in {:.2f} s: {:.1f} "
+                     "req/s",
+                     results["clients"].get<size_t>(),
+                     results["threads"].get<unsigned int>(),
+                     results["requests"].get<size_t>(),
+                     results["elapsed_s"].get<double>(),
+                     results["requests_per_s"].get<double>())
+              << "\n";
+    if (results["failed_clients"].get<size_t>())
+        std::cout << results["failed_clients"].get<size_t>()
+                  << " clients stopped because of an error\n";
+    std::cout << fmt::format("{:<8}{:>10}{:>8}{:>12}{:>12}{:>12}{:>12}",
+                             "op", "count", "errors", "p50_us", "p99_us",
+                             "p999_us", "max_us")
+              << "\n";
+    for (const auto &op : results["ops"].items()) {
+        const auto &stats = op.value();
+        std::cout << fmt::format(
+                         "{:<8}{:>10}{:>8}{:>12.1f}{:>12.1f}{:>12.1f}{:>12.1f}",
+                         op.key(), stats["count"].get<size_t>(),
+                         stats["errors"].get<size_t>(),
+                         stats["p50_us"].get<double>(),
+                         stats["p99_us"].get<double>(),
+                         stats["p999_us"].get<double>(),
+                         stats["max_us"].get<double>())
+                  << "\n";
+    }
+    std::cout << std::flush;
+}
+
+static void usage(const char *program) {
+    std::cout
+        << "Usage: " << program << " [options]\n"
+        << "  --clients N      concurrent connections (16)\n"
+        << "  --threads N      threads running the connections (1)\n"
+        << "  --requests N     commands per client, instead of --duration\n"
+        << "  --duration S     seconds to run for (10)\n"
+        << "  --ping W         weight of PING in the mix (8)\n"
+        << "  --status W       weight of MM_GET_*_STATUS in the mix (2)\n"
+        << "  --add-stop W     weight of MM_ADD_MONITOR + MM_STOP_MONITOR in "
+           "the mix (1)\n"
+        << "  --json           print the results as json\n";
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    try {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg{argv[i]};
+            if (arg == "--json") {
+                options.printJson = true;
+                continue;
+            }
+            if (i + 1 == argc)
+                throw std::invalid_argument(arg);
+            const std::string value{argv[++i]};
+            if (arg == "--clients")
+                options.clients = std::stoul(value);
+            else if (arg == "--threads")
+                options.threads = std::stoul(value);
+            else if (arg == "--requests")
+                options.requests = std::stoul(value);
+            else if (arg == "--duration")
+                options.duration = std::chrono::seconds(std::stoul(value));
+            else if (arg == "--ping")
+                options.ping = std::stod(value);
+            else if (arg == "--status")
+                options.status = std::stod(value);
+            else if (arg == "--add-stop")
+                options.addStop = std::stod(value);
+            else
+                throw std::invalid_argument(arg);
+        }
+    } catch (std::logic_error &) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!options.clients || !options.threads ||
+        options.ping + options.status + options.addStop <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    initMaps();
+    io_context io;
+    Bench bench(io, options,
+                local::stream_protocol::endpoint(
+                    getConfig().p_parser.get<std::string>(
+                        "GlobalConfig.socket_path") +
+                    "/MonitorManager"));
+    if (!bench.connect())
+        return 2;
+
+    const auto start = Clock::now();
+    bench.start();
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < options.threads; i++)
+        pool.emplace_back([&io] { io.run(); });
+    io.run();
+    for (auto &thread : pool)
+        thread.join();
+    const auto results = bench.results(
+        std::chrono::duration<double>(Clock::now() - start).count());
+
+    if (options.printJson)
+        std::cout << results.dump() << std::endl;
+    else
+        printResults(results);
+    return results["failed_clients"].get<size_t>() ? 3 : 0;
+}
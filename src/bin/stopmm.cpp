@@ -8,7 +8,8 @@ int main() {
     io_context io;
     kekmonitors::init();
     auto logger = kekmonitors::utils::getLogger("Stopmm");
-    auto connection = kekmonitors::Connection::create(io);
+    auto connection = kekmonitors::Connection::create(
+        io, kekmonitors::Framing::LengthPrefixed);
     try {
         connection->p_endpoint.connect(local::stream_protocol::endpoint(
             kekmonitors::utils::getLocalKekDir() + "/sockets/MonitorManager"));
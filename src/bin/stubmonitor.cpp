@@ -0,0 +1,60 @@
+/*
+ * Stands in for a python monitor/scraper when GlobalConfig.stub_monitor points
+ * to it, so that moman can add and stop processes without python nor the
+ * database (see momanbench). It listens on socket_path/<socket name>, answers
+ * PING and exits after answering STOP.
+ */
+#include "server.hpp"
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <iostream>
+#include <kekmonitors/utils.hpp>
+
+using namespace kekmonitors;
+
+class StubMonitor {
+  private:
+    UnixServer *m_server{nullptr};
+
+  public:
+    void setServer(UnixServer *server) { m_server = server; }
+
+    void onPing(const Cmd &, const UserResponseCallback &&cb,
+                Connection::Ptr connection) {
+        cb(Response::okResponse(), connection);
+    }
+
+    void onStop(const Cmd &, const UserResponseCallback &&cb,
+                Connection::Ptr connection) {
+        cb(Response::okResponse(), connection);
+        // io runs out once the response is written and moman closes the
+        // connection
+        m_server->shutdown();
+    }
+};
+
+static constexpr CmdHandlerEntry s_handlers[] = {
+    {COMMANDS::PING,
+     CmdDispatcher<StubMonitor>::handler<&StubMonitor::onPing>},
+    {COMMANDS::STOP,
+     CmdDispatcher<StubMonitor>::handler<&StubMonitor::onStop>}};
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <Monitor|Scraper>.<class name>"
+                  << std::endl;
+        return 1;
+    }
+    init();
+    {
+        io_context io;
+        StubMonitor stub;
+        UnixServer server(io, argv[1], Strand(io.get_executor()), &stub,
+                          makeCmdHandlerTable(s_handlers));
+        stub.setServer(&server);
+        server.startAccepting();
+        io.run();
+    }
+    spdlog::shutdown();
+    return 0;
+}
@@ -0,0 +1,245 @@
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <kekmonitors/channel.hpp>
+
+namespace kekmonitors {
+
+Channel::Channel(io_context &io, const Strand &strand,
+                 local::stream_protocol::endpoint endpoint, Framing framing,
+                 Encoding encoding)
+    : m_io(io), m_strand(strand), m_endpoint(std::move(endpoint)),
+      m_framing(framing), m_encoding(encoding) {
+    KDBG("Allocating new channel to {}", m_endpoint.path());
+}
+
+Channel::~Channel() { KDBG("Channel destroyed"); }
+
+Channel::Ptr Channel::create(io_context &io, const Strand &strand,
+                             const local::stream_protocol::endpoint &endpoint,
+                             Framing framing, Encoding encoding) {
+    return std::make_shared<Channel>(io, strand, endpoint, framing, encoding);
+}
+
+void Channel::asyncSendCmd(Cmd cmd, ResponseCallback &&cb,
+                           const steady_timer::duration &timeout) {
+    asyncSendCmd(SharedCmd::create(std::move(cmd)), std::move(cb), timeout);
+}
+
+void Channel::asyncSendCmd(SharedCmd::Ptr cmd, ResponseCallback &&cb,
+                           const steady_timer::duration &timeout) {
+    if (m_strand.running_in_this_thread())
+        doSendCmd(std::move(cmd), std::move(cb), timeout);
+    else
+        dispatch(m_strand, [shared = shared_from_this(), this,
+                            cmd = std::move(cmd), cb = std::move(cb),
+                            timeout]() mutable {
+            doSendCmd(std::move(cmd), std::move(cb), timeout);
+        });
+}
+
+void Channel::doSendCmd(SharedCmd::Ptr &&cmd, ResponseCallback &&cb,
+                        const steady_timer::duration &timeout) {
+    if (m_framing != Framing::LengthPrefixed) {
+        sendOnNewConnection(cmd, std::move(cb), timeout);
+        return;
+    }
+
+    const auto requestId = m_nextRequestId++;
+    // 0 means "no request id"
+    if (!m_nextRequestId)
+        m_nextRequestId = 1;
+
+    auto shared = shared_from_this();
+    auto timer = std::make_unique<steady_timer>(m_io, timeout);
+    timer->async_wait(bind_executor(
+        m_strand, [shared, this, requestId](const error_code &err) {
+            if (!err)
+                complete(requestId, error::timed_out, Response{});
+        }));
+    m_pending.emplace(requestId,
+                      PendingRequest{std::move(cb), std::move(timer)});
+
+    if (m_isConnected)
+        write({std::move(cmd), requestId});
+    else {
+        m_waitingForConnection.push_back({std::move(cmd), requestId});
+        if (!m_connection)
+            connect();
+    }
+}
+
+void Channel::connect() {
+    m_connection = Connection::create(m_io, Framing::LengthPrefixed);
+    m_connection->setEncoding(m_encoding);
+    m_connection->p_endpoint.async_connect(
+        m_endpoint,
+        bind_executor(m_strand, std::bind(&Channel::onConnect,
+                                          shared_from_this(), ph::_1,
+                                          m_connection)));
+}
+
+void Channel::onConnect(const error_code &err, Connection::Ptr connection) {
+    // closed in the meantime
+    if (connection != m_connection)
+        return;
+    if (err) {
+        m_connection = nullptr;
+        m_waitingForConnection.clear();
+        failAll(err);
+        return;
+    }
+    m_isConnected = true;
+    readResponses();
+    for (const auto &queued : m_waitingForConnection)
+        write(queued);
+    m_waitingForConnection.clear();
+}
+
+void Channel::write(const QueuedCmd &queued) {
+    auto shared = shared_from_this();
+    const auto requestId = queued.requestId;
+    m_connection->asyncWriteCmd(
+        queued.cmd, requestId,
+        [shared, this, requestId](const error_code &err, Connection::Ptr) {
+            if (err)
+                post(m_strand, [shared, this, requestId, err] {
+                    complete(requestId, err, Response{});
+                });
+        });
+}
+
+void Channel::readResponses() {
+    auto shared = shared_from_this();
+    auto connection = m_connection;
+    connection->asyncReadResponse(
+        [shared, this, connection](const error_code &err,
+                                   const Response &response, Connection::Ptr) {
+            post(m_strand, [shared, this, connection, err, response] {
+                onResponse(connection, err, response);
+            });
+        },
+        Connection::s_idleTimeout);
+}
+
+void Channel::onResponse(const Connection::Ptr &connection,
+                         const error_code &err, const Response &response) {
+    if (connection != m_connection)
+        return;
+    if (err &&
+        err != boost::system::errc::make_error_code(
+                   boost::system::errc::invalid_argument)) {
+        // the connection is unusable: the next cmd will reconnect
+        m_connection = nullptr;
+        m_isConnected = false;
+        failAll(err);
+        return;
+    }
+    // a message that failed to parse still has its request id
+    readResponses();
+    complete(response.requestId(), err, response);
+}
+
+void Channel::complete(uint32_t requestId, const error_code &err,
+                       const Response &response) {
+    auto it = m_pending.find(requestId);
+    if (it == m_pending.end()) {
+        KDBG("Dropping response for unknown request {}", requestId);
+        return;
+    }
+    auto cb = std::move(it->second.callback);
+    it->second.timeout->cancel();
+    m_pending.erase(it);
+    cb(err, response);
+}
+
+void Channel::failAll(const error_code &err) {
+    auto pending = std::move(m_pending);
+    m_pending.clear();
+    for (auto &request : pending) {
+        request.second.timeout->cancel();
+        request.second.callback(err, Response{});
+    }
+}
+
+void Channel::sendOnNewConnection(const SharedCmd::Ptr &cmd,
+                                  ResponseCallback &&cb,
+                                  const steady_timer::duration &timeout) {
+    auto connection = Connection::create(m_io, m_framing);
+    // cb must run on m_strand, while the connection completes on its own
+    auto strand = m_strand;
+    connection->p_endpoint.async_connect(
+        m_endpoint, bind_executor(m_strand, [connection, cmd, cb, timeout,
+                                             strand](const error_code &err) {
+            if (err) {
+                cb(err, Response{});
+                return;
+            }
+            connection->asyncWriteCmd(
+                cmd, 0, [cb, timeout, strand](const error_code &err,
+                                              Connection::Ptr connection) {
+                    if (err) {
+                        post(strand, [cb, err] { cb(err, Response{}); });
+                        return;
+                    }
+                    connection->asyncReadResponse(
+                        [cb, strand](const error_code &err,
+                                     const Response &response,
+                                     Connection::Ptr) {
+                            post(strand,
+                                 [cb, err, response] { cb(err, response); });
+                        },
+                        timeout);
+                });
+        }));
+}
+
+void Channel::close() {
+    m_waitingForConnection.clear();
+    if (m_connection) {
+        m_connection->close();
+        m_connection = nullptr;
+    }
+    m_isConnected = false;
+    failAll(error::operation_aborted);
+}
+
+const local::stream_protocol::endpoint &Channel::endpoint() const {
+    return m_endpoint;
+}
+Framing Channel::framing() const { return m_framing; }
+Encoding Channel::encoding() const { return m_encoding; }
+size_t Channel::inFlight() const { return m_pending.size(); }
+
+ChannelPool::ChannelPool(io_context &io, const Strand &strand, Framing framing,
+                         Encoding encoding)
+    : m_io(io), m_strand(strand), m_framing(framing), m_encoding(encoding) {}
+
+ChannelPool::~ChannelPool() { closeAll(); }
+
+Channel::Ptr
+ChannelPool::get(const local::stream_protocol::endpoint &endpoint) {
+    auto &channel = m_channels[endpoint.path()];
+    if (!channel)
+        channel = Channel::create(m_io, m_strand, endpoint, m_framing,
+                                  m_encoding);
+    return channel;
+}
+
+void ChannelPool::remove(const local::stream_protocol::endpoint &endpoint) {
+    auto it = m_channels.find(endpoint.path());
+    if (it != m_channels.end()) {
+        auto channel = std::move(it->second);
+        m_channels.erase(it);
+        channel->close();
+    }
+}
+
+void ChannelPool::closeAll() {
+    auto channels = std::move(m_channels);
+    m_channels.clear();
+    for (auto &channel : channels)
+        channel.second->close();
+}
+} // namespace kekmonitors
@@ -13,8 +13,30 @@ const std::string Config::s_defaultConfig = boost::str(
         "[GlobalConfig]\n"
         "socket_path = %s/sockets\n"
         "log_path = %s/logs\n"
+        "log_max_size_mb = 10\n"
+        "log_max_files = 3\n"
+        "log_queue_size = 8192\n"
+        "log_rate_limit = 50\n"
         "db_name = kekmonitors\n"
         "db_path = mongodb://localhost:27017/\n"
+        "registry_refresh_interval = 60\n"
+        "batch_concurrency = 16\n"
+        "add_timeout_ms = 10000\n"
+        "config_debounce_ms = 200\n"
+        "config_push_concurrency = 32\n"
+        "config_push_timeout_ms = 3000\n"
+        "config_push_reports = 16\n"
+        "multiplexed_connections = False\n"
+        "wire_encoding = json\n"
+        "moman_threads = 1\n"
+        "python_executable = \n"
+        "zygote = False\n"
+        "zygote_preload = kekmonitors\n"
+        "stub_monitor = \n"
+        "config_snapshot = False\n"
+        "config_snapshot_name = /kekmonitors-config\n"
+        "metrics_file = False\n"
+        "metrics_interval_s = 15\n"
         "\n"
         "[WebhookConfig]\n"
         "crash_webhook = \n"
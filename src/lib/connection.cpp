@@ -1,15 +1,27 @@
 //
 // Created by berton on 09/07/21.
 //
+#include <algorithm>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
 #include <kekmonitors/connection.hpp>
+#include <string_view>
 
 namespace kekmonitors {
 
-Connection::Connection(io_context &io)
-    : m_io(io), m_buffer(1024), p_endpoint(io), m_timeout(io) {
+const steady_timer::duration Connection::s_idleTimeout =
+    std::chrono::seconds(60);
+const size_t Connection::s_maxSpareBuffers = 4;
+const size_t Connection::s_maxSpareBufferCapacity = 1024 * 1024;
+const size_t Connection::s_maxWriteBatch = 32;
+
+Connection::Connection(io_context &io, Framing framing)
+    : m_io(io), m_strand(io.get_executor()), m_framing(framing),
+      m_timeout(io), p_endpoint(io) {
     KDBG("Allocating new connection");
 }
 
@@ -23,103 +35,361 @@ Connection::~Connection() {
 void Connection::onTimeout(const error_code &err) {
     if (err) {
         if (err != error::operation_aborted) {
-            KDBG(err.message());
+            KDBG("{}", err.message());
             return;
         }
-    } else {
+    } else if (!m_inFlight) {
+        // otherwise requestStarted() came while the handler was queued
         KDBG("Connection timed out");
         p_endpoint.close();
     }
 }
 
-Connection::Ptr Connection::create(io_context &io) {
-    return std::make_shared<Connection>(io);
+void Connection::armTimeout() {
+    m_timeout.expires_after(m_readTimeout);
+    m_timeout.async_wait(bind_executor(
+        m_strand, std::bind(&Connection::onTimeout, shared_from_this(),
+                            ph::_1)));
+}
+
+Connection::Ptr Connection::create(io_context &io, Framing framing) {
+    return std::make_shared<Connection>(io, framing);
+}
+
+Framing Connection::framing() const { return m_framing; }
+void Connection::setFraming(Framing framing) { m_framing = framing; }
+Encoding Connection::encoding() const { return m_encoding; }
+void Connection::setEncoding(Encoding encoding) { m_encoding = encoding; }
+const Strand &Connection::strand() const { return m_strand; }
+
+void Connection::close() {
+    dispatch(m_strand, std::bind(&Connection::doClose, shared_from_this()));
+}
+
+void Connection::requestStarted() {
+    dispatch(m_strand, [shared = shared_from_this(), this]() {
+        m_inFlight++;
+        m_timeout.cancel();
+    });
+}
+
+void Connection::requestDone() {
+    dispatch(m_strand, [shared = shared_from_this(), this]() {
+        if (m_inFlight && !--m_inFlight && m_reading)
+            armTimeout();
+    });
+}
+
+void Connection::doClose() {
+    error_code ec;
+    p_endpoint.close(ec);
+    m_timeout.cancel();
+}
+
+Encoding Connection::writeEncoding() const {
+    return m_framing == Framing::LengthPrefixed ? m_encoding.load()
+                                                : Encoding::Json;
+}
+
+void Connection::asyncReadMessage(std::function<void(const error_code &)> &&cb,
+                                  const steady_timer::duration &timeout) {
+    if (!m_strand.running_in_this_thread()) {
+        dispatch(m_strand, [shared = shared_from_this(), this, cb,
+                            timeout]() mutable {
+            asyncReadMessage(std::move(cb), timeout);
+        });
+        return;
+    }
+    m_readTimeout = timeout;
+    m_reading = true;
+    if (!m_inFlight)
+        armTimeout();
+    m_buffer.clear();
+    m_readRequestId = 0;
+    m_readEncoding = Encoding::Json;
+    switch (m_framing) {
+    case Framing::Eof:
+        readUntilEof(cb);
+        break;
+    case Framing::LengthPrefixed:
+        readFrame(0, cb);
+        break;
+    case Framing::Detect: {
+        auto shared = shared_from_this();
+        async_read(p_endpoint, buffer(m_readHeader.data(), 1),
+                   bind_executor(m_strand, [shared, this, cb](
+                                               const error_code &err,
+                                               size_t read) {
+                       if (err) {
+                           onReadComplete(err, cb);
+                           return;
+                       }
+                       if (static_cast<uint8_t>(m_readHeader[0]) ==
+                           FrameHeader::s_magic) {
+                           m_framing = Framing::LengthPrefixed;
+                           readFrame(1, cb);
+                       } else {
+                           m_framing = Framing::Eof;
+                           m_buffer.push_back(m_readHeader[0]);
+                           readUntilEof(cb);
+                       }
+                   }));
+        break;
+    }
+    }
+}
+
+void Connection::readUntilEof(
+    const std::function<void(const error_code &)> &cb) {
+    auto shared = shared_from_this();
+    async_read(p_endpoint, dynamic_buffer(m_buffer, FrameHeader::s_maxLength),
+               bind_executor(m_strand, [shared, this, cb](
+                                           const error_code &err,
+                                           size_t read) {
+                   if (err == error::eof)
+                       onReadComplete(error_code{}, cb);
+                   else if (!err)
+                       // the buffer is full but the peer is still sending
+                       onReadComplete(error::message_size, cb);
+                   else
+                       onReadComplete(err, cb);
+               }));
+}
+
+void Connection::readFrame(size_t headerOffset,
+                           const std::function<void(const error_code &)> &cb) {
+    auto shared = shared_from_this();
+    async_read(
+        p_endpoint,
+        buffer(m_readHeader.data() + headerOffset,
+               FrameHeader::s_size - headerOffset),
+        bind_executor(m_strand, [shared, this, cb](const error_code &err,
+                                                   size_t read) {
+            if (err) {
+                onReadComplete(err, cb);
+                return;
+            }
+            error_code ec;
+            const auto header = FrameHeader::decode(m_readHeader, ec);
+            if (ec) {
+                onReadComplete(ec, cb);
+                return;
+            }
+            m_readRequestId = header.p_requestId;
+            m_readEncoding = header.encoding();
+            m_encoding = m_readEncoding;
+            m_buffer.resize(header.p_length);
+            async_read(p_endpoint, buffer(m_buffer),
+                       bind_executor(m_strand,
+                                     [shared, this, cb](const error_code &err,
+                                                        size_t read) {
+                                         onReadComplete(err, cb);
+                                     }));
+        }));
+}
+
+void Connection::onReadComplete(
+    const error_code &err, const std::function<void(const error_code &)> &cb) {
+    m_reading = false;
+    m_timeout.cancel();
+    if (err && err != error::operation_aborted)
+        KDBG("{}", err.message());
+    cb(err);
 }
 
 void Connection::asyncReadCmd(const CmdCallback &&cb,
                               const steady_timer::duration &timeout) {
-    m_timeout.expires_after(timeout);
-    m_timeout.async_wait(std::bind(&Connection::onTimeout, this, ph::_1));
     auto shared = shared_from_this();
-    async_read(p_endpoint, buffer(m_buffer),
-               [shared, this, cb](const error_code &err, size_t read) {
-                   Cmd cmd;
-                   if (!err || err == error::eof) {
-                       m_timeout.cancel();
-                       error_code ec;
-                       std::string buf{m_buffer.begin(), m_buffer.end()};
-                       cmd = Cmd::fromString(buf, ec);
-                       if (ec) {
-                           KDBG("Received connection but couldn't parse from "
-                                "json: " +
-                                buf);
-                       }
-                       cb(ec, cmd, shared);
-                   } else if (err && err != error::operation_aborted) {
-                       KDBG(err.message());
-                       cb(err, cmd, shared);
-                   } else // operation aborted
-                   {
-                       cb(err, cmd, shared);
-                   }
-               });
+    asyncReadMessage(
+        [shared, this, cb](const error_code &err) {
+            Cmd cmd;
+            if (err) {
+                cb(err, cmd, shared);
+                return;
+            }
+            error_code ec;
+            cmd = Cmd::fromString(m_buffer.data(), m_buffer.size(),
+                                  m_readEncoding, ec);
+            cmd.setRequestId(m_readRequestId);
+            cmd.setEncoding(m_readEncoding);
+            if (ec) {
+                KDBG("Received connection but couldn't parse from json: {}",
+                     std::string_view(m_buffer.data(), m_buffer.size()));
+            }
+            cb(ec, cmd, shared);
+        },
+        timeout);
+}
+
+std::string Connection::takeBuffer() {
+    std::lock_guard<std::mutex> lock(m_spareBuffersMutex);
+    if (m_spareBuffers.empty())
+        return {};
+    auto buffer = std::move(m_spareBuffers.back());
+    m_spareBuffers.pop_back();
+    return buffer;
+}
+
+void Connection::recycleBuffer(std::string &&buffer) {
+    if (buffer.capacity() > s_maxSpareBufferCapacity)
+        return;
+    buffer.clear();
+    std::lock_guard<std::mutex> lock(m_spareBuffersMutex);
+    if (m_spareBuffers.size() < s_maxSpareBuffers)
+        m_spareBuffers.push_back(std::move(buffer));
+}
+
+void Connection::asyncWriteMessage(std::string &&message, uint32_t requestId,
+                                   Encoding encoding, WriteCallback &&cb) {
+    if (!m_strand.running_in_this_thread()) {
+        dispatch(m_strand, [shared = shared_from_this(), this,
+                            message = std::move(message), requestId, encoding,
+                            cb = std::move(cb)]() mutable {
+            asyncWriteMessage(std::move(message), requestId, encoding,
+                              std::move(cb));
+        });
+        return;
+    }
+    FrameHeader header(static_cast<uint32_t>(message.size()), requestId);
+    header.setEncoding(encoding);
+    queueMessage(
+        {header.encode(), std::move(message), nullptr, std::move(cb)});
+}
+
+void Connection::asyncWriteMessage(SharedCmd::Bytes message,
+                                   uint32_t requestId, Encoding encoding,
+                                   WriteCallback &&cb) {
+    if (!m_strand.running_in_this_thread()) {
+        dispatch(m_strand, [shared = shared_from_this(), this,
+                            message = std::move(message), requestId, encoding,
+                            cb = std::move(cb)]() mutable {
+            asyncWriteMessage(std::move(message), requestId, encoding,
+                              std::move(cb));
+        });
+        return;
+    }
+    FrameHeader header(static_cast<uint32_t>(message->size()), requestId);
+    header.setEncoding(encoding);
+    queueMessage({header.encode(), {}, std::move(message), std::move(cb)});
+}
+
+void Connection::queueMessage(OutgoingMessage &&message) {
+    if (m_framing == Framing::LengthPrefixed &&
+        message.bytes().size() > FrameHeader::s_maxLength) {
+        auto shared = shared_from_this();
+        post(m_strand, [shared, cb = std::move(message.callback)] {
+            cb(error::message_size, shared);
+        });
+        return;
+    }
+    m_writeQueue.push_back(std::move(message));
+    if (!m_writing)
+        writeQueuedMessages();
+}
+
+void Connection::writeQueuedMessages() {
+    auto shared = shared_from_this();
+    // an Eof connection shuts down after its message, so it never batches
+    const bool framed = m_framing == Framing::LengthPrefixed;
+    m_writing = framed ? std::min(m_writeQueue.size(), s_maxWriteBatch) : 1;
+    // header and data of every message, as scatter/gather segments
+    std::vector<const_buffer> buffers;
+    buffers.reserve(2 * m_writing);
+    for (size_t i = 0; i < m_writing; i++) {
+        const auto &message = m_writeQueue[i];
+        if (framed)
+            buffers.push_back(buffer(message.header));
+        buffers.push_back(buffer(message.bytes()));
+    }
+    auto onWritten = [shared, this](const error_code &err, size_t written) {
+        std::vector<WriteCallback> callbacks;
+        callbacks.reserve(m_writing);
+        for (; m_writing; m_writing--) {
+            auto &front = m_writeQueue.front();
+            callbacks.push_back(std::move(front.callback));
+            if (!front.sharedData)
+                recycleBuffer(std::move(front.data));
+            m_writeQueue.pop_front();
+        }
+        if (err)
+            KDBG("{}", err.message());
+        if (m_framing != Framing::LengthPrefixed) {
+            // the peer reads until eof
+            error_code ec;
+            p_endpoint.shutdown(local::stream_protocol::socket::shutdown_send,
+                                ec);
+        }
+        if (!m_writeQueue.empty())
+            writeQueuedMessages();
+        for (const auto &cb : callbacks)
+            cb(err, shared);
+    };
+    async_write(p_endpoint, buffers,
+                bind_executor(m_strand, std::move(onWritten)));
 }
 
 void Connection::asyncWriteResponse(
     const Response &response,
     const std::function<void(const error_code &, Ptr)> &&cb) {
-    auto shared = shared_from_this();
-    async_write(p_endpoint, buffer(response.toString()),
-                [shared, cb](const error_code &err, size_t read) {
-                    if (err)
-                        KDBG(err.message());
-                    shared->p_endpoint.shutdown(
-                        local::stream_protocol::socket::shutdown_send);
-                    cb(err, shared);
-                });
+    asyncWriteResponse(response, response.requestId(), std::move(cb));
+}
+
+void Connection::asyncWriteResponse(
+    const Response &response, uint32_t requestId,
+    const std::function<void(const error_code &, Ptr)> &&cb) {
+    asyncWriteResponse(response, requestId, writeEncoding(), std::move(cb));
+}
+
+void Connection::asyncWriteResponse(
+    const Response &response, uint32_t requestId, Encoding encoding,
+    const std::function<void(const error_code &, Ptr)> &&cb) {
+    if (m_framing != Framing::LengthPrefixed)
+        encoding = Encoding::Json;
+    auto message = takeBuffer();
+    response.serialize(message, encoding);
+    asyncWriteMessage(std::move(message), requestId, encoding,
+                      WriteCallback{cb});
 }
 
 void Connection::asyncWriteCmd(
     const Cmd &cmd, std::function<void(const error_code &, Ptr)> &&cb) {
-    auto shared = shared_from_this();
-    async_write(p_endpoint, buffer(cmd.toString()),
-                [shared, cb](const error_code &err, size_t read) {
-                    if (err)
-                        KDBG(err.message());
-                    shared->p_endpoint.shutdown(
-                        local::stream_protocol::socket::shutdown_send);
-                    cb(err, shared);
-                });
+    const auto encoding = writeEncoding();
+    auto message = takeBuffer();
+    cmd.serialize(message, encoding);
+    asyncWriteMessage(std::move(message), cmd.requestId(), encoding,
+                      std::move(cb));
+}
+
+void Connection::asyncWriteCmd(
+    const SharedCmd::Ptr &cmd, uint32_t requestId,
+    std::function<void(const error_code &, Ptr)> &&cb) {
+    const auto encoding = writeEncoding();
+    asyncWriteMessage(cmd->encoded(encoding), requestId, encoding,
+                      std::move(cb));
 }
 
 void Connection::asyncReadResponse(
     std::function<void(const error_code &, const Response &, Ptr)> &&cb,
     const steady_timer::duration &timeout) {
-    m_timeout.expires_after(timeout);
-    m_timeout.async_wait(std::bind(&Connection::onTimeout, this, ph::_1));
     auto shared = shared_from_this();
-    async_read(p_endpoint, buffer(m_buffer),
-               [shared, this, cb](const error_code &err, size_t read) {
-                   Response response;
-                   if (!err || err == error::eof) {
-                       m_timeout.cancel();
-                       error_code ec;
-                       std::string buf{m_buffer.begin(), m_buffer.end()};
-                       response = Response::fromString(buf, ec);
-                       if (ec) {
-                           KDBG("Received connection but couldn't parse from "
-                                "json: " +
-                                buf);
-                       }
-                       cb(ec, response, shared);
-                   } else if (err && err != error::operation_aborted) {
-                       KDBG(err.message());
-                       cb(err, response, shared);
-                   } else // operation aborted
-                   {
-                       cb(err, response, shared);
-                   }
-               });
+    asyncReadMessage(
+        [shared, this, cb](const error_code &err) {
+            Response response;
+            if (err) {
+                cb(err, response, shared);
+                return;
+            }
+            error_code ec;
+            response = Response::fromString(m_buffer.data(), m_buffer.size(),
+                                            m_readEncoding, ec);
+            response.setRequestId(m_readRequestId);
+            if (ec) {
+                KDBG("Received connection but couldn't parse from json: {}",
+                     std::string_view(m_buffer.data(), m_buffer.size()));
+            }
+            cb(ec, response, shared);
+        },
+        timeout);
 }
 
 void Connection::quickWriteCmd(
@@ -141,4 +411,4 @@ void Connection::quickWriteCmd(
     });
 }
 
-} // namespace kekmonitors
\ No newline at end of file
+} // namespace kekmonitors
@@ -3,6 +3,7 @@
 //
 #include <kekmonitors/core.hpp>
 #include <kekmonitors/config.hpp>
+#include <atomic>
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 #define CORE_REGISTER_COMMAND(cmd)                                             \
@@ -20,11 +21,21 @@ std::string getStringWithoutNamespaces(const std::string &command) {
 }
 
 namespace kekmonitors {
+// KDBG uses the raw pointer instead of looking the logger up in the
+// registry, s_debugLoggerOwner keeps it alive after spdlog::shutdown()
+static std::shared_ptr<spdlog::logger> s_debugLoggerOwner;
+static std::atomic<spdlog::logger *> s_debugLogger{nullptr};
+
 void initDebugLogger() {
-    auto dbgLog = spdlog::stdout_color_st("KDBG");
-    auto formatter = std::make_unique<spdlog::pattern_formatter>();
+    auto dbgLog = spdlog::stdout_color_mt("KDBG");
     dbgLog->set_pattern("%v");
     dbgLog->set_level(spdlog::level::debug);
+    s_debugLoggerOwner = dbgLog;
+    s_debugLogger.store(dbgLog.get(), std::memory_order_release);
+}
+
+spdlog::logger *debugLogger() {
+    return s_debugLogger.load(std::memory_order_acquire);
 }
 
 void initMaps() {
@@ -80,6 +91,13 @@ void initMaps() {
     CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_SET_MONITOR_SCRAPER_CONFIG);
     CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_GET_MONITOR_SHOES);
     CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_GET_SCRAPER_SHOES);
+    CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_ADD_MONITORS);
+    CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_ADD_SCRAPERS);
+    CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_STOP_MONITORS);
+    CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_STOP_SCRAPERS);
+    CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::CONFIG_SNAPSHOT_UPDATED);
+    CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_GET_CONFIG_PUSHES);
+    CORE_REGISTER_COMMAND(kekmonitors::COMMANDS::MM_GET_METRICS);
 
     CORE_REGISTER_ERROR(kekmonitors::ERRORS::OK);
     CORE_REGISTER_ERROR(kekmonitors::ERRORS::SOCKET_DOESNT_EXIST);
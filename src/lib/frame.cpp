@@ -0,0 +1,55 @@
+#include <boost/asio/error.hpp>
+#include <kekmonitors/frame.hpp>
+
+namespace kekmonitors {
+
+static void writeUint32(char *dest, uint32_t value) {
+    for (size_t i = 0; i < 4; i++)
+        dest[i] = static_cast<char>((value >> (24 - 8 * i)) & 0xff);
+}
+
+static uint32_t readUint32(const char *src) {
+    uint32_t value{0};
+    for (size_t i = 0; i < 4; i++)
+        value = (value << 8) | static_cast<uint8_t>(src[i]);
+    return value;
+}
+
+Encoding FrameHeader::encoding() const {
+    return static_cast<Encoding>(p_flags & s_encodingMask);
+}
+
+void FrameHeader::setEncoding(Encoding encoding) {
+    p_flags = (p_flags & ~s_encodingMask) | static_cast<uint8_t>(encoding);
+}
+
+FrameHeader::Bytes FrameHeader::encode() const {
+    Bytes bytes{};
+    bytes[0] = static_cast<char>(s_magic);
+    bytes[1] = static_cast<char>(s_version);
+    bytes[2] = static_cast<char>(p_flags);
+    bytes[3] = 0;
+    writeUint32(bytes.data() + 4, p_length);
+    writeUint32(bytes.data() + 8, p_requestId);
+    return bytes;
+}
+
+FrameHeader FrameHeader::decode(const Bytes &bytes, error_code &ec) {
+    FrameHeader header;
+    if (static_cast<uint8_t>(bytes[0]) != s_magic ||
+        static_cast<uint8_t>(bytes[1]) != s_version) {
+        ec = boost::system::errc::make_error_code(
+            boost::system::errc::protocol_error);
+        return header;
+    }
+    header.p_flags = static_cast<uint8_t>(bytes[2]);
+    header.p_length = readUint32(bytes.data() + 4);
+    header.p_requestId = readUint32(bytes.data() + 8);
+    if (header.p_length > s_maxLength)
+        ec = boost::asio::error::message_size;
+    else if (header.encoding() > Encoding::Cbor)
+        ec = boost::system::errc::make_error_code(
+            boost::system::errc::protocol_error);
+    return header;
+}
+} // namespace kekmonitors
@@ -23,6 +23,7 @@
  *
  */
 
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/system/detail/errc.hpp>
 #include <boost/system/detail/error_code.hpp>
@@ -298,7 +299,15 @@ void InotifyWatch::__Disable() {
     IN_WRITE_END
 }
 
-Inotify::Inotify(boost::asio::io_context &io) noexcept(false) : m_afd(io) {
+Inotify::Inotify(boost::asio::io_context &io) noexcept(false)
+    : Inotify(io, boost::asio::strand<boost::asio::io_context::executor_type>(
+                      io.get_executor())) {}
+
+Inotify::Inotify(
+    boost::asio::io_context &io,
+    const boost::asio::strand<boost::asio::io_context::executor_type>
+        &strand) noexcept(false)
+    : m_afd(io), m_strand(strand) {
     IN_LOCK_INIT
 
     m_fd = inotify_init();
@@ -480,7 +489,9 @@ void Inotify::AsyncStartWaitForEvents(std::function<void()> &&cb) {
 void Inotify::AsyncWaitForEvents() {
     m_afd.async_read_some(
         boost::asio::buffer(m_buf),
-        [=](const boost::system::error_code &errc, size_t len) {
+        boost::asio::bind_executor(m_strand, [=](const boost::system::error_code
+                                                     &errc,
+                                                 size_t len) {
             if (!errc) {
                 IN_WRITE_BEGIN
                 ssize_t i = 0;
@@ -504,7 +515,7 @@ void Inotify::AsyncWaitForEvents() {
                        errc != boost::system::errc::operation_canceled) {
                 AsyncWaitForEvents();
             }
-        });
+        }));
 }
 
 bool Inotify::GetEvent(InotifyEvent *pEvt) noexcept(false) {
@@ -1,45 +1,282 @@
 #include <iostream>
 #include <kekmonitors/msg.hpp>
 #include <kekmonitors/utils.hpp>
+#include <string_view>
+#ifdef KEKMONITORS_HAVE_SIMDJSON
+#include <simdjson.h>
+#endif
 
 namespace kekmonitors {
 
+// discarded if data is not valid, nothing throws
+static json parse(const char *data, size_t size, Encoding encoding) {
+    switch (encoding) {
+    case Encoding::MessagePack:
+        return json::from_msgpack(data, data + size, true, false);
+    case Encoding::Cbor:
+        return json::from_cbor(data, data + size, true, false);
+    default:
+        return json::parse(data, data + size, nullptr, false);
+    }
+}
+
+static const error_code s_invalidArgument =
+    boost::system::errc::make_error_code(
+        boost::system::errc::invalid_argument);
+
+// parses the raw payload left by LazyJsonDecoder, if any. It was validated
+// by then: error is only set if nlohmann still refuses it
+static const json &materialize(json &payload, std::string &rawPayload,
+                               error_code &error) {
+    if (!rawPayload.empty() && !error) {
+        payload = json::parse(rawPayload, nullptr, false);
+        if (payload.is_discarded()) {
+            payload = nullptr;
+            error = s_invalidArgument;
+        } else
+            std::string{}.swap(rawPayload);
+    }
+    return payload;
+}
+
+static void throwIfInvalidPayload(const error_code &payloadError) {
+    if (payloadError)
+        throw std::invalid_argument("The payload isn't valid json");
+}
+
+#ifdef KEKMONITORS_HAVE_SIMDJSON
+/*
+ * Reads Cmd and Response from json text with the simdjson on-demand API: only
+ * the top level fields are parsed, the payload is just delimited and copied as
+ * text, to be parsed by nlohmann the first time payload() is called. The
+ * payload is still validated, so that a message is accepted by this decoder
+ * exactly when it would be by json::parse.
+ */
+struct LazyJsonDecoder {
+    // simdjson needs SIMDJSON_PADDING readable bytes after the message, which
+    // the read buffer of Connection doesn't have: it's copied here first. Both
+    // keep their capacity, so that a thread doesn't allocate once warmed up
+    static thread_local simdjson::ondemand::parser s_parser;
+    static thread_local std::string s_padded;
+    // on demand only checks that the skipped payload is balanced
+    static thread_local simdjson::dom::parser s_validator;
+
+    // calls onField(key, value) for every field of the object in
+    // [data, data + size), stopping at the first that returns false
+    template <typename F>
+    static bool forEachField(const char *data, size_t size, F &&onField) {
+        s_padded.reserve(size + simdjson::SIMDJSON_PADDING);
+        s_padded.assign(data, size);
+        simdjson::ondemand::document doc;
+        if (s_parser
+                .iterate(simdjson::padded_string_view(s_padded.data(), size,
+                                                      s_padded.capacity()))
+                .get(doc))
+            return false;
+        simdjson::ondemand::object obj;
+        if (doc.get_object().get(obj))
+            return false;
+        for (auto result : obj) {
+            simdjson::ondemand::field field;
+            std::string_view key;
+            if (std::move(result).get(field) ||
+                field.unescaped_key().get(key) ||
+                !onField(key, field.value()))
+                return false;
+        }
+        return doc.at_end();
+    }
+
+    // a null payload is the same as no payload
+    static bool readRawPayload(simdjson::ondemand::value &value,
+                               std::string &rawPayload) {
+        simdjson::ondemand::json_type type;
+        if (value.type().get(type))
+            return false;
+        if (type == simdjson::ondemand::json_type::null) {
+            rawPayload.clear();
+            return true;
+        }
+        std::string_view raw;
+        if (value.raw_json().get(raw))
+            return false;
+        // raw is in s_padded, which has the padding after it
+        simdjson::dom::element element;
+        if (s_validator.parse(raw.data(), raw.size(), false).get(element))
+            return false;
+        rawPayload.assign(raw.data(), raw.size());
+        return true;
+    }
+
+    template <typename T>
+    static bool readInteger(simdjson::ondemand::value &value, T &out) {
+        int64_t integer;
+        if (value.get_int64().get(integer))
+            return false;
+        out = static_cast<T>(integer);
+        return true;
+    }
+
+    static bool decode(const char *data, size_t size, Cmd &cmd) {
+        bool hasCmd = false;
+        const auto onField = [&](std::string_view key,
+                                 simdjson::ondemand::value &value) {
+            if (key == "_Cmd__cmd")
+                return hasCmd = readInteger(value, cmd.m_cmd);
+            if (key == "_Cmd__payload")
+                return readRawPayload(value, cmd.m_rawPayload);
+            return true;
+        };
+        return forEachField(data, size, onField) && hasCmd;
+    }
+
+    static bool decode(const char *data, size_t size, Response &response) {
+        bool hasError = false;
+        const auto onField = [&](std::string_view key,
+                                 simdjson::ondemand::value &value) {
+            if (key == "_Response__error")
+                return hasError = readInteger(value, response.m_error);
+            if (key == "_Response__payload")
+                return readRawPayload(value, response.m_rawPayload);
+            if (key == "_Response__info") {
+                // ignored if it's not a string, like in fromJson
+                std::string_view info;
+                if (!value.get_string().get(info))
+                    response.m_info.assign(info.data(), info.size());
+            }
+            return true;
+        };
+        return forEachField(data, size, onField) && hasError;
+    }
+};
+
+thread_local simdjson::ondemand::parser LazyJsonDecoder::s_parser;
+thread_local std::string LazyJsonDecoder::s_padded;
+thread_local simdjson::dom::parser LazyJsonDecoder::s_validator;
+#endif
+
+/*
+ * Writes an object field by field straight into out: the same bytes as dump(),
+ * to_msgpack() or to_cbor() of the equivalent json, without building it first.
+ * The fields must come in the order nlohmann keeps them, sorted by key. Only
+ * the public api of nlohmann is used: the values are appended by dump() and
+ * the to_msgpack()/to_cbor() overloads taking a string, the rest is written
+ * by hand.
+ */
+class ObjectWriter {
+  private:
+    const Encoding m_encoding;
+    std::string &m_out;
+    bool m_first{true};
+
+    // keys are short ascii strings: fixstr in msgpack, and a text string with
+    // its length in the initial byte in cbor
+    void key(std::string_view key) {
+        switch (m_encoding) {
+        case Encoding::MessagePack:
+            m_out.push_back(static_cast<char>(0xa0 | key.size()));
+            m_out.append(key);
+            break;
+        case Encoding::Cbor:
+            m_out.push_back(static_cast<char>(0x60 | key.size()));
+            m_out.append(key);
+            break;
+        default:
+            if (!m_first)
+                m_out.push_back(',');
+            m_first = false;
+            m_out.push_back('"');
+            m_out.append(key);
+            m_out.append("\":");
+        }
+    }
+
+  public:
+    ObjectWriter(std::string &out, Encoding encoding, size_t fields)
+        : m_encoding(encoding), m_out(out) {
+        // fixmap and map(n) headers: a message has at most 3 fields
+        switch (m_encoding) {
+        case Encoding::MessagePack:
+            m_out.push_back(static_cast<char>(0x80 | fields));
+            break;
+        case Encoding::Cbor:
+            m_out.push_back(static_cast<char>(0xa0 | fields));
+            break;
+        default:
+            m_out.push_back('{');
+        }
+    }
+
+    void field(std::string_view name, const json &value) {
+        key(name);
+        switch (m_encoding) {
+        case Encoding::MessagePack:
+            json::to_msgpack(value, m_out);
+            break;
+        case Encoding::Cbor:
+            json::to_cbor(value, m_out);
+            break;
+        default:
+            m_out.append(value.dump());
+        }
+    }
+
+    void end() {
+        if (m_encoding == Encoding::Json)
+            m_out.push_back('}');
+    }
+};
+
+static constexpr std::string_view s_cmdKey = "_Cmd__cmd";
+static constexpr std::string_view s_cmdPayloadKey = "_Cmd__payload";
+static constexpr std::string_view s_responseErrorKey = "_Response__error";
+static constexpr std::string_view s_responseInfoKey = "_Response__info";
+static constexpr std::string_view s_responsePayloadKey = "_Response__payload";
+
 Cmd::Cmd() : m_cmd(COMMANDS::PING){};
 Cmd::~Cmd() = default;
 
+// the optional fields are looked up with find(): a message without them, like
+// most PINGs, must not cost an exception
 Cmd Cmd::fromJson(const json &obj) {
-    Cmd cmd;
-    bool success = false;
-    try {
-        cmd.m_cmd = obj.at("_Cmd__cmd");
-    } catch (json::exception &e) {
-        throw std::invalid_argument("Json object doesn't contain \"_Cmd__cmd\"");
-    }
-    try {
-        cmd.m_payload = obj.at("_Cmd__payload");
-    } catch (json::exception &e) {
-    };
+    error_code ec;
+    Cmd cmd = fromJson(obj, ec);
+    if (ec)
+        throw std::invalid_argument(
+            "Json object doesn't contain \"_Cmd__cmd\"");
     return cmd;
 };
 
-Cmd Cmd::fromJson(const json &obj, error_code &ec)
-{
+Cmd Cmd::fromJson(const json &obj, error_code &ec) {
     Cmd cmd;
-    try {
-        cmd.m_cmd = obj.at("_Cmd__cmd");
-    } catch (json::exception &e) {
-        ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
-    }
-    try {
-        cmd.m_payload = obj.at("_Cmd__payload");
-    } catch (json::exception &e) {
-    };
+    const auto cmdIt = obj.find("_Cmd__cmd");
+    if (cmdIt != obj.end() && cmdIt->is_number_integer())
+        cmd.m_cmd = cmdIt->get<CommandType>();
+    else
+        ec = s_invalidArgument;
+    const auto payloadIt = obj.find("_Cmd__payload");
+    if (payloadIt != obj.end())
+        cmd.m_payload = *payloadIt;
+    return cmd;
+}
+
+Cmd Cmd::fromJson(json &&obj, error_code &ec) {
+    Cmd cmd;
+    const auto cmdIt = obj.find("_Cmd__cmd");
+    if (cmdIt != obj.end() && cmdIt->is_number_integer())
+        cmd.m_cmd = cmdIt->get<CommandType>();
+    else
+        ec = s_invalidArgument;
+    const auto payloadIt = obj.find("_Cmd__payload");
+    if (payloadIt != obj.end())
+        cmd.m_payload = std::move(*payloadIt);
     return cmd;
 }
 
 json Cmd::toJson() const {
     json j;
     j["_Cmd__cmd"] = m_cmd;
+    throwIfInvalidPayload(payloadError());
     if (!m_payload.is_null())
         j["_Cmd__payload"] = m_payload;
     return j;
@@ -50,59 +287,140 @@ Cmd Cmd::fromString(const std::string &str) {
 }
 
 Cmd Cmd::fromString(const std::string &str, error_code &ec) {
-    try {
-        return fromJson(json::parse(str), ec);
+    return fromString(str.data(), str.size(), ec);
+}
+
+Cmd Cmd::fromString(const char *data, size_t size, error_code &ec) {
+    return fromString(data, size, Encoding::Json, ec);
+}
+
+Cmd Cmd::fromString(const char *data, size_t size, Encoding encoding,
+                    error_code &ec) {
+#ifdef KEKMONITORS_HAVE_SIMDJSON
+    if (encoding == Encoding::Json) {
+        Cmd cmd;
+        if (!LazyJsonDecoder::decode(data, size, cmd)) {
+            ec = s_invalidArgument;
+            return Cmd();
+        }
+        return cmd;
     }
-    catch(json::exception &e)
-    {
-        ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+#endif
+    auto obj = parse(data, size, encoding);
+    if (obj.is_discarded()) {
+        ec = s_invalidArgument;
         return Cmd();
     }
+    return fromJson(std::move(obj), ec);
+}
+
+Cmd Cmd::fromString(const boost::asio::const_buffer &buffer, error_code &ec) {
+    return fromString(static_cast<const char *>(buffer.data()), buffer.size(),
+                      ec);
 }
 
-std::string Cmd::toString() const { return toJson().dump(); }
+std::string Cmd::toString() const { return toString(Encoding::Json); }
+std::string Cmd::toString(Encoding encoding) const {
+    std::string str;
+    serialize(str, encoding);
+    return str;
+}
+
+void Cmd::serialize(std::string &out, Encoding encoding) const {
+    throwIfInvalidPayload(payloadError());
+    const bool hasPayload = !m_payload.is_null();
+    ObjectWriter writer(out, encoding, hasPayload ? 2 : 1);
+    writer.field(s_cmdKey, json(m_cmd));
+    if (hasPayload)
+        writer.field(s_cmdPayloadKey, m_payload);
+    writer.end();
+}
 
 kekmonitors::CommandType Cmd::cmd() const { return m_cmd; }
 void Cmd::setCmd(kekmonitors::CommandType cmd) { m_cmd = cmd; }
-const json &Cmd::payload() const { return m_payload; }
-void Cmd::setPayload(const json &payload) { m_payload = payload; }
+const json &Cmd::payload() const {
+    return materialize(m_payload, m_rawPayload, m_payloadError);
+}
+const error_code &Cmd::payloadError() const {
+    payload();
+    return m_payloadError;
+}
+void Cmd::setPayload(const json &payload) {
+    m_payload = payload;
+    m_rawPayload.clear();
+    m_payloadError.clear();
+}
+void Cmd::setPayload(json &&payload) {
+    m_payload = std::move(payload);
+    m_rawPayload.clear();
+    m_payloadError.clear();
+}
+uint32_t Cmd::requestId() const { return m_requestId; }
+void Cmd::setRequestId(uint32_t requestId) { m_requestId = requestId; }
+Encoding Cmd::encoding() const { return m_encoding; }
+void Cmd::setEncoding(Encoding encoding) { m_encoding = encoding; }
+
+// the payload is parsed here, if it's still raw, since encoded() may be
+// called from many threads
+SharedCmd::SharedCmd(Cmd cmd) : m_cmd(std::move(cmd)) { m_cmd.payload(); }
+
+SharedCmd::Ptr SharedCmd::create(Cmd cmd) {
+    return std::make_shared<const SharedCmd>(std::move(cmd));
+}
+
+const Cmd &SharedCmd::cmd() const { return m_cmd; }
+
+const SharedCmd::Bytes &SharedCmd::encoded(Encoding encoding) const {
+    const auto index = static_cast<size_t>(encoding);
+    std::call_once(m_encodedOnce[index], [this, encoding, index] {
+        auto bytes = std::make_shared<std::string>();
+        m_cmd.serialize(*bytes, encoding);
+        m_encoded[index] = std::move(bytes);
+    });
+    return m_encoded[index];
+}
 
 Response::Response() : m_error(ERRORS::OK){};
 Response::~Response() = default;
 
 Response Response::fromJson(const json &obj) {
-    Response response;
-    try {
-        response.m_error = obj.at("_Response__error");
-    } catch (json::exception &e) {
-        throw std::invalid_argument("Json object doesn't contain \"_Response__error\"");
-    };
-    try {
-        response.m_payload = obj.at("_Response__payload");
-    } catch (json::exception &e) {
-    };
-    try {
-        response.m_info = obj.at("_Response__info");
-    } catch (json::exception &e) {
-    };
+    error_code ec;
+    Response response = fromJson(obj, ec);
+    if (ec)
+        throw std::invalid_argument(
+            "Json object doesn't contain \"_Response__error\"");
     return response;
 };
 
 Response Response::fromJson(const json &obj, error_code &ec) {
     Response response;
-    try {
-        response.m_error = obj.at("_Response__error");
-    } catch (json::exception &e) {
-        ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
-    };
-    try {
-        response.m_payload = obj.at("_Response__payload");
-    } catch (json::exception &e) {
-    };
-    try {
-        response.m_info = obj.at("_Response__info");
-    } catch (json::exception &e) {
-    };
+    const auto errorIt = obj.find("_Response__error");
+    if (errorIt != obj.end() && errorIt->is_number_integer())
+        response.m_error = errorIt->get<ErrorType>();
+    else
+        ec = s_invalidArgument;
+    const auto payloadIt = obj.find("_Response__payload");
+    if (payloadIt != obj.end())
+        response.m_payload = *payloadIt;
+    const auto infoIt = obj.find("_Response__info");
+    if (infoIt != obj.end() && infoIt->is_string())
+        response.m_info = infoIt->get_ref<const std::string &>();
+    return response;
+};
+
+Response Response::fromJson(json &&obj, error_code &ec) {
+    Response response;
+    const auto errorIt = obj.find("_Response__error");
+    if (errorIt != obj.end() && errorIt->is_number_integer())
+        response.m_error = errorIt->get<ErrorType>();
+    else
+        ec = s_invalidArgument;
+    const auto payloadIt = obj.find("_Response__payload");
+    if (payloadIt != obj.end())
+        response.m_payload = std::move(*payloadIt);
+    const auto infoIt = obj.find("_Response__info");
+    if (infoIt != obj.end() && infoIt->is_string())
+        response.m_info = std::move(infoIt->get_ref<std::string &>());
     return response;
 };
 
@@ -111,16 +429,34 @@ json Response::toJson() const {
     j["_Response__error"] = m_error;
     if (!m_info.empty())
         j["_Response__info"] = m_info;
+    throwIfInvalidPayload(payloadError());
     if (!m_payload.is_null())
         j["_Response__payload"] = m_payload;
     return j;
 };
 kekmonitors::ErrorType Response::error() const { return m_error; }
 void Response::setError(kekmonitors::ErrorType error) { m_error = error; }
-const json &Response::payload() const { return m_payload; }
-void Response::setPayload(const json &payload) { m_payload = payload; }
+const json &Response::payload() const {
+    return materialize(m_payload, m_rawPayload, m_payloadError);
+}
+const error_code &Response::payloadError() const {
+    payload();
+    return m_payloadError;
+}
+void Response::setPayload(const json &payload) {
+    m_payload = payload;
+    m_rawPayload.clear();
+    m_payloadError.clear();
+}
+void Response::setPayload(json &&payload) {
+    m_payload = std::move(payload);
+    m_rawPayload.clear();
+    m_payloadError.clear();
+}
 const std::string &Response::info() const { return m_info; }
 void Response::setInfo(const std::string &info) { m_info = info; }
+uint32_t Response::requestId() const { return m_requestId; }
+void Response::setRequestId(uint32_t requestId) { m_requestId = requestId; }
 
 Response Response::okResponse() {
     Response resp;
@@ -132,19 +468,60 @@ Response Response::badResponse() {
     resp.setError(ERRORS::OTHER_ERROR);
     return resp;
 }
-std::string Response::toString() const { return toJson().dump(); }
+std::string Response::toString() const { return toString(Encoding::Json); }
+std::string Response::toString(Encoding encoding) const {
+    std::string str;
+    serialize(str, encoding);
+    return str;
+}
+
+void Response::serialize(std::string &out, Encoding encoding) const {
+    throwIfInvalidPayload(payloadError());
+    const bool hasPayload = !m_payload.is_null();
+    ObjectWriter writer(out, encoding, 1 + !m_info.empty() + hasPayload);
+    writer.field(s_responseErrorKey, json(m_error));
+    if (!m_info.empty())
+        writer.field(s_responseInfoKey, json(m_info));
+    if (hasPayload)
+        writer.field(s_responsePayloadKey, m_payload);
+    writer.end();
+}
 Response Response::fromString(const std::string &str) {
     return fromJson(json::parse(str));
 }
 
-Response Response::fromString(const std::string &str, error_code &ec)
-{
-    try {
-        return fromJson(json::parse(str), ec);
-    } catch (json::exception &e) {
-        ec = boost::system::errc::make_error_code(
-            boost::system::errc::invalid_argument);
+Response Response::fromString(const std::string &str, error_code &ec) {
+    return fromString(str.data(), str.size(), ec);
+}
+
+Response Response::fromString(const char *data, size_t size,
+                              error_code &ec) {
+    return fromString(data, size, Encoding::Json, ec);
+}
+
+Response Response::fromString(const char *data, size_t size,
+                              Encoding encoding, error_code &ec) {
+#ifdef KEKMONITORS_HAVE_SIMDJSON
+    if (encoding == Encoding::Json) {
+        Response response;
+        if (!LazyJsonDecoder::decode(data, size, response)) {
+            ec = s_invalidArgument;
+            return Response();
+        }
+        return response;
+    }
+#endif
+    auto obj = parse(data, size, encoding);
+    if (obj.is_discarded()) {
+        ec = s_invalidArgument;
         return Response();
     }
+    return fromJson(std::move(obj), ec);
+}
+
+Response Response::fromString(const boost::asio::const_buffer &buffer,
+                              error_code &ec) {
+    return fromString(static_cast<const char *>(buffer.data()), buffer.size(),
+                      ec);
 }
 }; // namespace kekmonitors
@@ -0,0 +1,221 @@
+#include <boost/asio/bind_executor.hpp>
+#include <cerrno>
+#include <csignal>
+#include <deque>
+#include <fcntl.h>
+#include <kekmonitors/process.hpp>
+#include <mutex>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_set>
+
+extern char **environ;
+
+namespace kekmonitors {
+
+const boost::asio::steady_timer::duration Process::s_pollInterval =
+    std::chrono::milliseconds(250);
+
+// the children tracked by a Process, and the exit status of the untracked
+// ones reaped by reapUntracked(): a script forked by the Zygote may exit
+// before the reply with its pid is read and the Process adopting it is made
+static std::mutex s_childrenMutex;
+static std::unordered_set<pid_t> s_trackedPids;
+static std::deque<std::pair<pid_t, int>> s_reapedStatuses;
+static const size_t s_maxReapedStatuses = 256;
+
+// false, with the exit status, if pid has already been reaped
+static bool track(pid_t pid, int &status) {
+    std::lock_guard<std::mutex> lock(s_childrenMutex);
+    for (auto it = s_reapedStatuses.begin(); it != s_reapedStatuses.end();
+         ++it) {
+        if (it->first == pid) {
+            status = it->second;
+            s_reapedStatuses.erase(it);
+            return false;
+        }
+    }
+    s_trackedPids.insert(pid);
+    return true;
+}
+
+static void untrack(pid_t pid) {
+    std::lock_guard<std::mutex> lock(s_childrenMutex);
+    s_trackedPids.erase(pid);
+}
+
+static int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+Process::Process(boost::asio::io_context &io, const Strand &strand,
+                 std::string className, ExitCallback &&onExit)
+    : m_className(std::move(className)), m_creation(std::time(nullptr)),
+      m_strand(strand), m_pidfd(io), m_pollTimer(io),
+      m_onExit(std::move(onExit)) {
+    KDBG("Constructed process");
+}
+
+Process::~Process() {
+    if (running())
+        terminate();
+    else if (m_pid != -1 && !m_exited)
+        // exited but not reaped yet: left to reapUntracked()
+        untrack(m_pid);
+    KDBG("Destroyed process");
+}
+
+Process::Ptr Process::create(boost::asio::io_context &io, const Strand &strand,
+                             std::string className,
+                             const std::string &executable,
+                             const std::vector<std::string> &args,
+                             ExitCallback &&onExit, std::error_code &ec,
+                             int stdinFd) {
+    std::vector<char *> argv;
+    argv.reserve(args.size() + 2);
+    argv.push_back(const_cast<char *>(executable.c_str()));
+    for (const auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (stdinFd != -1)
+        posix_spawn_file_actions_adddup2(&actions, stdinFd, STDIN_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+    pid_t pid;
+    // glibc implements posix_spawn with clone(CLONE_VM | CLONE_VFORK): the
+    // address space of the daemon is never copied
+    const int err = posix_spawn(&pid, executable.c_str(), &actions, nullptr,
+                                argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err) {
+        ec = std::error_code(err, std::system_category());
+        return nullptr;
+    }
+
+    return adopt(io, strand, std::move(className), pid, std::move(onExit));
+}
+
+Process::Ptr Process::adopt(boost::asio::io_context &io, const Strand &strand,
+                            std::string className, pid_t pid,
+                            ExitCallback &&onExit) {
+    auto process = std::make_unique<Process>(io, strand, std::move(className),
+                                             std::move(onExit));
+    process->m_pid = pid;
+    int status = 0;
+    if (track(pid, status))
+        process->waitForExit();
+    else
+        process->onReaped(status);
+    return process;
+}
+
+bool Process::reapUntracked() {
+    for (;;) {
+        // WNOWAIT: a tracked child is left to the pidfd handler of its Process
+        siginfo_t info{};
+        if (::waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 ||
+            info.si_pid == 0)
+            return true;
+        std::lock_guard<std::mutex> lock(s_childrenMutex);
+        if (s_trackedPids.count(info.si_pid))
+            return false;
+        int status = 0;
+        if (::waitpid(info.si_pid, &status, WNOHANG) != info.si_pid)
+            continue;
+        s_reapedStatuses.emplace_back(info.si_pid, status);
+        if (s_reapedStatuses.size() > s_maxReapedStatuses)
+            s_reapedStatuses.pop_front();
+    }
+}
+
+void Process::waitForExit() {
+    const int pidfd = pidfdOpen(m_pid);
+    if (pidfd == -1) {
+        pollForExit();
+        return;
+    }
+    m_pidfd.assign(pidfd);
+    // a pidfd becomes readable once the process exits
+    m_pidfd.async_wait(
+        boost::asio::posix::stream_descriptor::wait_read,
+        boost::asio::bind_executor(m_strand, [this](const error_code &err) {
+            if (err)
+                return;
+            int status = 0;
+            if (::waitpid(m_pid, &status, 0) == m_pid)
+                onExit(status);
+        }));
+}
+
+void Process::pollForExit() {
+    m_pollTimer.expires_after(s_pollInterval);
+    m_pollTimer.async_wait(
+        boost::asio::bind_executor(m_strand, [this](const error_code &err) {
+            if (err)
+                return;
+            int status = 0;
+            if (::waitpid(m_pid, &status, WNOHANG) == m_pid)
+                onExit(status);
+            else
+                pollForExit();
+        }));
+}
+
+void Process::onReaped(int status) {
+    // the exit callback is never called before adopt() returns
+    m_pollTimer.expires_after(boost::asio::steady_timer::duration::zero());
+    m_pollTimer.async_wait(boost::asio::bind_executor(
+        m_strand, [this, status](const error_code &err) {
+            if (!err)
+                onExit(status);
+        }));
+}
+
+void Process::onExit(int status) {
+    untrack(m_pid);
+    m_exited = true;
+    error_code ec;
+    m_pidfd.close(ec);
+    const int exitCode = WIFEXITED(status) ? WEXITSTATUS(status)
+                                           : 128 + WTERMSIG(status);
+    // might destroy this
+    auto cb = std::move(m_onExit);
+    if (cb)
+        cb(exitCode, std::error_code{});
+}
+
+bool Process::running() const {
+    if (m_pid == -1 || m_exited)
+        return false;
+    // WNOWAIT: leave the process to the pidfd handler
+    siginfo_t info{};
+    if (::waitid(P_PID, m_pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1)
+        return false;
+    return info.si_pid == 0;
+}
+
+void Process::terminate() {
+    if (m_pid == -1 || m_exited)
+        return;
+    ::kill(m_pid, SIGKILL);
+    ::waitpid(m_pid, nullptr, 0);
+    untrack(m_pid);
+    m_exited = true;
+    m_onExit = nullptr;
+    m_pollTimer.cancel();
+    error_code ec;
+    m_pidfd.close(ec);
+}
+} // namespace kekmonitors
@@ -0,0 +1,182 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <kekmonitors/snapshot.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace kekmonitors {
+
+static std::error_code lastError() {
+    return std::error_code(errno, std::system_category());
+}
+
+std::string configSnapshotDataName(const std::string &name,
+                                   uint64_t generation) {
+    return name + "." + std::to_string(generation);
+}
+
+ConfigSnapshotPublisher::ConfigSnapshotPublisher(std::string name)
+    : m_name(std::move(name)) {}
+
+ConfigSnapshotPublisher::~ConfigSnapshotPublisher() {
+    if (m_header)
+        munmap(m_header, sizeof(ConfigSnapshotHeader));
+}
+
+bool ConfigSnapshotPublisher::open(std::error_code &ec) {
+    const int fd = shm_open(m_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+        ec = lastError();
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        (static_cast<size_t>(st.st_size) < sizeof(ConfigSnapshotHeader) &&
+         ftruncate(fd, sizeof(ConfigSnapshotHeader)) == -1)) {
+        ec = lastError();
+        ::close(fd);
+        return false;
+    }
+    void *addr = mmap(nullptr, sizeof(ConfigSnapshotHeader),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        ec = lastError();
+        return false;
+    }
+    m_header = static_cast<ConfigSnapshotHeader *>(addr);
+    if (m_header->magic == ConfigSnapshotHeader::s_magic &&
+        m_header->layoutVersion == ConfigSnapshotHeader::s_layoutVersion)
+        // left by a previous run: readers must never see the generation go
+        // back
+        m_generation = m_header->generation.load();
+    else {
+        m_header->generation.store(0);
+        m_header->layoutVersion = ConfigSnapshotHeader::s_layoutVersion;
+        m_header->magic = ConfigSnapshotHeader::s_magic;
+    }
+    return true;
+}
+
+uint64_t ConfigSnapshotPublisher::publish(const nlohmann::json &snapshot,
+                                          std::error_code &ec) {
+    if (!m_header) {
+        ec = std::make_error_code(std::errc::bad_file_descriptor);
+        return 0;
+    }
+    const uint64_t generation = m_generation + 1;
+    const auto dataName = configSnapshotDataName(m_name, generation);
+    std::vector<uint8_t> payload;
+    nlohmann::json::to_msgpack(snapshot, payload);
+    const size_t size = sizeof(ConfigSnapshotData) + payload.size();
+
+    // O_EXCL: a leftover with the same name would be a stale generation
+    shm_unlink(dataName.c_str());
+    const int fd =
+        shm_open(dataName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0444);
+    if (fd == -1) {
+        ec = lastError();
+        return 0;
+    }
+    if (ftruncate(fd, size) == -1) {
+        ec = lastError();
+        ::close(fd);
+        shm_unlink(dataName.c_str());
+        return 0;
+    }
+    void *addr = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        ec = lastError();
+        shm_unlink(dataName.c_str());
+        return 0;
+    }
+    auto data = static_cast<ConfigSnapshotData *>(addr);
+    data->magic = ConfigSnapshotHeader::s_magic;
+    data->generation = generation;
+    data->encoding = Encoding::MessagePack;
+    std::memset(data->reserved, 0, sizeof(data->reserved));
+    data->size = payload.size();
+    std::memcpy(data + 1, payload.data(), payload.size());
+    munmap(addr, size);
+
+    m_header->generation.store(generation, std::memory_order_release);
+    if (m_generation)
+        shm_unlink(configSnapshotDataName(m_name, m_generation).c_str());
+    m_generation = generation;
+    return generation;
+}
+
+bool readConfigSnapshot(const std::string &name, nlohmann::json &snapshot,
+                        uint64_t &generation, std::error_code &ec) {
+    const int headerFd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (headerFd == -1) {
+        ec = lastError();
+        return false;
+    }
+    void *headerAddr = mmap(nullptr, sizeof(ConfigSnapshotHeader), PROT_READ,
+                            MAP_SHARED, headerFd, 0);
+    ::close(headerFd);
+    if (headerAddr == MAP_FAILED) {
+        ec = lastError();
+        return false;
+    }
+    const auto header = static_cast<const ConfigSnapshotHeader *>(headerAddr);
+    bool ok = false;
+    ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    // a generation can be unlinked between reading the header and opening it
+    for (int attempt = 0; attempt < 3 && !ok; attempt++) {
+        if (header->magic != ConfigSnapshotHeader::s_magic ||
+            header->layoutVersion != ConfigSnapshotHeader::s_layoutVersion) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            break;
+        }
+        generation = header->generation.load(std::memory_order_acquire);
+        if (!generation)
+            break;
+        const int fd = shm_open(
+            configSnapshotDataName(name, generation).c_str(), O_RDONLY, 0);
+        if (fd == -1) {
+            ec = lastError();
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1 ||
+            static_cast<size_t>(st.st_size) < sizeof(ConfigSnapshotData)) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            ::close(fd);
+            break;
+        }
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            ec = lastError();
+            break;
+        }
+        const auto data = static_cast<const ConfigSnapshotData *>(addr);
+        const auto payload = reinterpret_cast<const uint8_t *>(data + 1);
+        if (data->magic != ConfigSnapshotHeader::s_magic ||
+            data->encoding != Encoding::MessagePack ||
+            data->size > st.st_size - sizeof(ConfigSnapshotData))
+            ec = std::make_error_code(std::errc::invalid_argument);
+        else {
+            try {
+                snapshot =
+                    nlohmann::json::from_msgpack(payload, payload + data->size);
+                ec.clear();
+                ok = true;
+            } catch (nlohmann::json::exception &) {
+                ec = std::make_error_code(std::errc::invalid_argument);
+            }
+        }
+        munmap(addr, st.st_size);
+        if (!ok)
+            break;
+    }
+    munmap(headerAddr, sizeof(ConfigSnapshotHeader));
+    return ok;
+}
+} // namespace kekmonitors
@@ -1,12 +1,20 @@
 //
 // Created by berton on 4/28/21.
 //
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/process.hpp>
 #include <kekmonitors/msg.hpp>
 #include <kekmonitors/utils.hpp>
+#include <cerrno>
+#include <chrono>
+#include <mutex>
+#include <spdlog/async.h>
+#include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <sstream>
+#include <string_view>
 #include <unistd.h>
+#include <unordered_map>
 
 namespace kekmonitors::utils {
 std::string getUserHomeDir() {
@@ -48,19 +56,159 @@ std::string getContentIfFileExistsElseCreate(const std::string &filepath,
     }
 }
 
-std::shared_ptr<spdlog::logger> getLogger(const std::string &name) {
-    auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
-    console_sink->set_level(spdlog::level::debug);
-    console_sink->set_pattern("[%^%n%$] %v");
+/*
+ * Drops the messages of a type (level and call site) logged more than m_rate
+ * times per second, and says how many were dropped once that type gets
+ * through again. The rest goes to m_async: a storm of identical messages
+ * can't fill its queue nor keep the sinks busy.
+ */
+class RateLimitedLogger : public spdlog::logger {
+  private:
+    struct Bucket {
+        double tokens;
+        std::chrono::steady_clock::time_point refilledAt;
+        uint64_t dropped{0};
+    };
+
+    const std::shared_ptr<spdlog::async_logger> m_async;
+    const double m_rate;
+    std::mutex m_mutex;
+    std::unordered_map<size_t, Bucket> m_buckets;
+
+    // the format string is gone by the time spdlog calls sink_it_: the call
+    // site if the message has one, otherwise its text without the digits, so
+    // that messages only differing in a pid, a count or a duration are of the
+    // same type
+    static size_t messageType(const spdlog::details::log_msg &msg) {
+        size_t hash = static_cast<size_t>(msg.level);
+        if (!msg.source.empty())
+            return hash ^ std::hash<const void *>{}(msg.source.filename) ^
+                   (static_cast<size_t>(msg.source.line) << 8);
+        // fnv-1a
+        hash ^= 14695981039346656037ull;
+        for (const char c : msg.payload) {
+            if (c >= '0' && c <= '9')
+                continue;
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+  protected:
+    void sink_it_(const spdlog::details::log_msg &msg) override {
+        const auto now = std::chrono::steady_clock::now();
+        const size_t type = messageType(msg);
+        uint64_t dropped = 0, forgotten = 0;
+        bool drop = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // mostly distinct messages: start over instead of growing, but
+            // still say how many were dropped
+            if (m_buckets.size() > 4096) {
+                for (const auto &it : m_buckets)
+                    forgotten += it.second.dropped;
+                m_buckets.clear();
+            }
+            auto it = m_buckets.try_emplace(type, Bucket{m_rate, now}).first;
+            auto &bucket = it->second;
+            bucket.tokens = std::min(
+                m_rate, bucket.tokens +
+                            std::chrono::duration<double>(now -
+                                                          bucket.refilledAt)
+                                    .count() *
+                                m_rate);
+            bucket.refilledAt = now;
+            if (bucket.tokens < 1) {
+                bucket.dropped++;
+                drop = true;
+            } else {
+                bucket.tokens--;
+                dropped = bucket.dropped;
+                bucket.dropped = 0;
+            }
+        }
+        if (forgotten)
+            m_async->log(msg.time, msg.source, spdlog::level::warn,
+                         fmt::format("({} rate limited messages were dropped)",
+                                     forgotten));
+        if (drop)
+            return;
+        m_async->log(msg.time, msg.source, msg.level, msg.payload);
+        if (dropped)
+            m_async->log(msg.time, msg.source, msg.level,
+                         fmt::format("({} similar messages were dropped)",
+                                     dropped));
+    }
+
+    void flush_() override { m_async->flush(); }
 
-    // auto file_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(
-    //     "logs/multisink.txt", true);
-    // file_sink->set_level(spdlog::level::trace);
+  public:
+    // async_logger is final: filter in front of it
+    RateLimitedLogger(std::shared_ptr<spdlog::async_logger> async, double rate)
+        : spdlog::logger(async->name()), m_async(std::move(async)),
+          m_rate(rate) {
+        m_async->set_level(spdlog::level::trace);
+    }
+};
 
-    auto logger = std::make_shared<spdlog::logger>(
-        name,
-        std::initializer_list<spdlog::sink_ptr>{console_sink /*, file_sink*/});
+// the console and log_path/<program>.log, shared by every logger
+static const std::vector<spdlog::sink_ptr> &getSinks() {
+    static const auto sinks = [] {
+        const auto &parser = getConfig().p_parser;
+        auto consoleSink =
+            std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+        consoleSink->set_level(spdlog::level::debug);
+        consoleSink->set_pattern("[%^%n%$] %v");
+        std::vector<spdlog::sink_ptr> sinks{consoleSink};
+        try {
+            const fs::path logPath =
+                parser.get<std::string>("GlobalConfig.log_path");
+            fs::create_directories(logPath);
+            auto fileSink =
+                std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
+                    (logPath / program_invocation_short_name).string() +
+                        ".log",
+                    parser.get<size_t>("GlobalConfig.log_max_size_mb", 10) *
+                        1024 * 1024,
+                    parser.get<size_t>("GlobalConfig.log_max_files", 3));
+            fileSink->set_level(spdlog::level::debug);
+            fileSink->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%l] %v");
+            sinks.push_back(fileSink);
+        } catch (std::exception &e) {
+            consoleSink->log(spdlog::details::log_msg(
+                "Logging", spdlog::level::err,
+                fmt::format("Couldn't open the log file: {}", e.what())));
+        }
+        // the queue drops the oldest messages when full instead of blocking
+        spdlog::init_thread_pool(
+            parser.get<size_t>("GlobalConfig.log_queue_size", 8192), 1);
+        spdlog::flush_every(std::chrono::seconds(1));
+        return sinks;
+    }();
+    return sinks;
+}
+
+std::shared_ptr<spdlog::logger> getLogger(const std::string &name) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto logger = spdlog::get(name))
+        return logger;
+    const auto &sinks = getSinks();
+    // messages per second of a single type, 0 means no limit
+    const double rate = getConfig().p_parser.get<double>(
+        "GlobalConfig.log_rate_limit", 50);
+    auto async = std::make_shared<spdlog::async_logger>(
+        name, sinks.begin(), sinks.end(), spdlog::thread_pool(),
+        spdlog::async_overflow_policy::overrun_oldest);
+    // on the async logger itself: RateLimitedLogger::sink_it_ skips the
+    // flush check of spdlog::logger
+    async->flush_on(spdlog::level::warn);
+    std::shared_ptr<spdlog::logger> logger = async;
+    if (rate > 0)
+        logger = std::make_shared<RateLimitedLogger>(async, rate);
     logger->set_level(spdlog::level::debug);
+    spdlog::register_logger(logger);
     return logger;
 }
 
@@ -89,31 +237,75 @@ std::string getStringWithoutNamespaces(CommandType command) {
         kekmonitors::utils::commandToString(command));
 }
 
-fs::path getPythonExecutable() {
+static bool isPython3(const fs::path &executable) {
     namespace bp = boost::process;
-    static fs::path pythonExecutable{};
-    if (pythonExecutable.empty()) {
-        for (const auto &pythonExe : {"python", "python3"}) {
-            bp::ipstream in;
-            std::string version;
-            try {
-                bp::system(std::string{pythonExe} + " --version",
-                           bp::std_out > in, bp::std_err > bp::null);
-                // "Python 2.7.18"
-                // "Python 3.6.12"
-                std::getline(in, version);
-                if (version[7] == '3') {
-                    pythonExecutable = pythonExe;
-                    return pythonExecutable;
-                }
-            } catch (bp::process_error &) {
-            }
-        }
+    bp::ipstream in;
+    std::string version;
+    try {
+        bp::system(bp::exe = executable.string(), bp::args = {"--version"},
+                   bp::std_out > in, bp::std_err > bp::null);
+        // "Python 2.7.18"
+        // "Python 3.6.12"
+        std::getline(in, version);
+        return version.size() > 7 && version[7] == '3';
+    } catch (bp::process_error &) {
+        return false;
+    }
+}
 
-        // no python executable found
-        throw std::exception();
+static fs::path searchPath(const std::string &name) {
+    const char *path = getenv("PATH");
+    if (!path)
+        return {};
+    std::istringstream dirs{path};
+    std::string dir;
+    while (std::getline(dirs, dir, ':')) {
+        const auto candidate = fs::path{dir.empty() ? "." : dir} / name;
+        if (fs::is_regular_file(candidate) && !access(candidate.c_str(), X_OK))
+            return fs::absolute(candidate);
     }
-    return pythonExecutable;
+    return {};
+}
+
+static fs::path findPythonExecutable() {
+    std::vector<std::string> candidates;
+    const auto configured = getConfig().p_parser.get<std::string>(
+        "GlobalConfig.python_executable", "");
+    if (!configured.empty())
+        candidates.push_back(configured);
+    else
+        candidates = {"python3", "python"};
+    for (const auto &candidate : candidates) {
+        // like execvp, only bare names are looked up in PATH
+        const fs::path executable =
+            candidate.find('/') == std::string::npos
+                ? searchPath(candidate)
+                : fs::absolute(fs::path{candidate});
+        if (!executable.empty() && isPython3(executable))
+            return executable;
+    }
+    return {};
+}
+
+fs::path getPythonExecutable() {
+    // kept once found: spawning a monitor shouldn't search the PATH. Until
+    // then it's looked up again, python may be installed in the meantime
+    static std::mutex s_mutex;
+    static fs::path s_pythonExecutable;
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (s_pythonExecutable.empty())
+        s_pythonExecutable = findPythonExecutable();
+    return s_pythonExecutable;
+}
+
+bool getConfigBool(const std::string &key, bool defaultValue) {
+    auto value = getConfig().p_parser.get<std::string>(key, "");
+    boost::algorithm::to_lower(value);
+    if (value == "1" || value == "yes" || value == "true" || value == "on")
+        return true;
+    if (value == "0" || value == "no" || value == "false" || value == "off")
+        return false;
+    return defaultValue;
 }
 
 Response makeCommonResponse(const Response &firstResponse,
@@ -136,4 +328,26 @@ Response makeCommonResponse(const Response &firstResponse,
     }
     return finalResponse;
 }
+
+Response makeBatchResponse(const std::vector<std::string> &names,
+                           const std::vector<Response> &responses,
+                           const ERRORS commonError) {
+    Response finalResponse = Response::okResponse();
+    json payload = json::object();
+    size_t failed = 0;
+    for (size_t i = 0; i < names.size() && i < responses.size(); i++) {
+        const auto &response = responses[i];
+        if (response.error())
+            failed++;
+        payload[names[i]] = {{"error", errorToString(response.error())},
+                             {"info", response.info()}};
+    }
+    if (failed) {
+        finalResponse.setError(commonError);
+        finalResponse.setInfo(std::to_string(failed) + " of " +
+                              std::to_string(names.size()) + " failed");
+    }
+    finalResponse.setPayload(std::move(payload));
+    return finalResponse;
+}
 } // namespace kekmonitors::utils